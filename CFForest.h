@@ -0,0 +1,198 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+#ifndef __CFFOREST_H__
+#define __CFFOREST_H__
+
+#include "CFTree.h"
+
+/** class CFForest, P independent CFTrees behind a coarse quantizer.
+ *
+ * a single CFTree serializes insertions at its root. the forest routes every data-point to the closest
+ * of P centers, trained by k-means on a sample, and inserts into the P trees in parallel, without locks:
+ * each tree owns its nodes and its rebuild schedule. clustering unions the leaf entries of all the trees.
+ *
+ * @param dim  dimensions of item, see CFTree
+ */
+template<boost::uint32_t dim>
+class CFForest
+{
+public:
+	typedef CFTree<dim> tree_type;
+	typedef typename tree_type::float_type float_type;
+	typedef typename tree_type::CFEntry CFEntry;
+	typedef typename tree_type::cfentry_vec_type cfentry_vec_type;
+	typedef typename tree_type::dist_func_type dist_func_type;
+	typedef typename tree_type::redist_index redist_index;
+
+	enum { default_sample_rows = 65536 }; /** # data-points the router is trained on when insert_rows() has to train it */
+
+	/** constructing n_trees empty trees, k_limit being shared out between them
+	 *
+	 * see CFTree::CFTree() for the other parameters
+	 */
+	CFForest( std::size_t n_trees, float_type in_dist_threshold, std::size_t in_k_limit, uint32_t in_rebuild_interval, dist_func_type in_dist_func = tree_type::_DistD0, dist_func_type in_absorb_dist_func = tree_type::_DistD0 ) :
+		trained(false)
+	{
+		n_trees = (std::max)( n_trees, (std::size_t)1 );
+		std::size_t tree_k_limit = in_k_limit > 0 ? (in_k_limit + n_trees - 1) / n_trees : 0;
+		for( std::size_t i = 0 ; i < n_trees ; i++ )
+			trees.push_back( new tree_type( in_dist_threshold, tree_k_limit, in_rebuild_interval, in_dist_func, in_absorb_dist_func ) );
+	}
+	~CFForest()
+	{
+		for( std::size_t i = 0 ; i < trees.size() ; i++ )
+			delete trees[i];
+	}
+
+	/** # trees */
+	std::size_t size() const { return trees.size(); }
+	/** the i-th tree */
+	tree_type& tree( std::size_t i ) { return *trees[i]; }
+	const tree_type& tree( std::size_t i ) const { return *trees[i]; }
+
+	/** training the router, k-means on sample seeded with evenly spaced data-points */
+	template<typename T>
+	void train( const typename tree_type::template basic_matrix_view<T>& sample, std::size_t iteration = 4 )
+	{
+		if( sample.rows == 0 )
+			return;
+
+		cfentry_vec_type centers;
+		for( std::size_t i = 0 ; i < trees.size() ; i++ )
+			centers.push_back( CFEntry( sample[i * sample.rows / trees.size()] ) );
+
+		std::vector<boost::int32_t> cids( sample.rows );
+		trees[0]->redist_kmeans( sample, centers, &cids[0], iteration );
+		trees[0]->prepare_redist( centers, router );
+		trained = true;
+	}
+
+	/** inserting a batch of data-points, each tree taking the ones routed to it.
+	 *
+	 * the router is trained on evenly spaced data-points of the first batch, if train() was not called.
+	 */
+	template<typename T>
+	void insert_rows( const typename tree_type::template basic_matrix_view<T>& items )
+	{
+		if( items.rows == 0 )
+			return;
+		if( !trained )
+			_train_on_batch( items );
+
+		// route, then sort rows by tree
+		std::vector<boost::int32_t> cids( items.rows );
+		trees[0]->redist( router, items, &cids[0] );
+
+		std::vector<std::size_t> offsets( trees.size() + 1, 0 );
+		for( std::size_t i = 0 ; i < items.rows ; i++ )
+			offsets[cids[i] + 1]++;
+		for( std::size_t p = 0 ; p < trees.size() ; p++ )
+			offsets[p + 1] += offsets[p];
+
+		std::vector<std::size_t> rows( items.rows );
+		std::vector<std::size_t> next( offsets.begin(), offsets.end() - 1 );
+		for( std::size_t i = 0 ; i < items.rows ; i++ )
+			rows[next[cids[i]]++] = i;
+
+		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, trees.size(), 1 ), _insert_body< typename tree_type::template basic_matrix_view<T> >( trees, items, rows, offsets ) );
+	}
+
+	/** rebuilding the trees in parallel, see CFTree::rebuild() */
+	void rebuild( bool extend = true )
+	{
+		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, trees.size(), 1 ), _rebuild_body( trees, extend ) );
+	}
+
+	/** leaf entries of all the trees, tree after tree */
+	void get_entries( cfentry_vec_type& out_entries )
+	{
+		out_entries.clear();
+		cfentry_vec_type entries;
+		for( std::size_t i = 0 ; i < trees.size() ; i++ )
+		{
+			trees[i]->get_entries( entries );
+			out_entries.insert( out_entries.end(), entries.begin(), entries.end() );
+		}
+	}
+
+	/** phase 3, clustering the union of the leaf entries of all the trees */
+	void cluster( cfentry_vec_type& entries )
+	{
+		get_entries( entries );
+		trees[0]->cluster_entries( entries );
+	}
+
+	/** the router, closest center of data-points being their tree */
+	const redist_index& get_router() const { return router; }
+
+private:
+	CFForest( const CFForest& );
+	CFForest& operator=( const CFForest& );
+
+	template<typename view_type>
+	void _train_on_batch( const view_type& items )
+	{
+		std::size_t n = (std::min)( items.rows, (std::size_t)default_sample_rows );
+		aligned_matrix<typename view_type::value_type> sample;
+		sample.resize( n, dim );
+		for( std::size_t i = 0 ; i < n ; i++ )
+			std::copy( items[i * items.rows / n], items[i * items.rows / n] + dim, sample[i] );
+		train( typename tree_type::template basic_matrix_view<typename view_type::value_type>( sample.data(), n ) );
+	}
+
+	template<typename view_type>
+	struct _insert_body
+	{
+		_insert_body( std::vector<tree_type*>& in_trees, const view_type& in_items, const std::vector<std::size_t>& in_rows, const std::vector<std::size_t>& in_offsets ) :
+			trees(in_trees), items(in_items), rows(in_rows), offsets(in_offsets) {}
+
+		void operator()( const tbb::blocked_range<std::size_t>& r ) const
+		{
+			for( std::size_t p = r.begin() ; p != r.end() ; p++ )
+				for( std::size_t i = offsets[p] ; i < offsets[p + 1] ; i++ )
+					trees[p]->insert( items[rows[i]] );
+		}
+
+		std::vector<tree_type*>&			trees;
+		const view_type&					items;
+		const std::vector<std::size_t>&		rows;
+		const std::vector<std::size_t>&		offsets;
+	};
+
+	struct _rebuild_body
+	{
+		_rebuild_body( std::vector<tree_type*>& in_trees, bool in_extend ) : trees(in_trees), extend(in_extend) {}
+
+		void operator()( const tbb::blocked_range<std::size_t>& r ) const
+		{
+			for( std::size_t p = r.begin() ; p != r.end() ; p++ )
+				trees[p]->rebuild( extend );
+		}
+
+		std::vector<tree_type*>&	trees;
+		bool						extend;
+	};
+
+	std::vector<tree_type*>	trees;
+	redist_index			router;
+	bool					trained;
+};
+
+#endif
@@ -24,14 +24,36 @@
 
 #include <vector>
 #include <list>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 #include <exception>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <filesystem>
 #include <assert.h>
 #include <time.h>
 #include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/numeric/ublas/symmetric.hpp>
 #include <boost/numeric/ublas/vector.hpp>
-#include "pmmintrin.h"
+#include <pmmintrin.h>
 #include "oneapi/tbb/scalable_allocator.h"
+#include "oneapi/tbb/blocked_range.h"
+#include "oneapi/tbb/parallel_for.h"
+#include "oneapi/tbb/parallel_invoke.h"
+#include "oneapi/tbb/combinable.h"
+#include "oneapi/tbb/parallel_pipeline.h"
+#include "oneapi/tbb/info.h"
+#include "oneapi/tbb/task_group.h"
+#include "birch_io.h"
 
 #define PAGE_SIZE			(4*1024) /* assuming 4K page */
 
@@ -56,15 +78,16 @@ template<boost::uint32_t dim>
 class CFTree
 {
 public:
-	class CFEntry;
-private:
-	class CFNode;
-	class CFNodeItmd;
-	class CFNodeLeaf;
+	struct CFEntry;
+	struct CFNode;
+	struct CFNodeItmd;
+	struct CFNodeLeaf;
 
 public:
 	/** this exception is produced when the current item size is not suitable. */
 	struct CFTreeInvalidItemSize : public std::exception {};
+	/** this exception is produced when a tree is read whole while it is rebuilt in the background, see finish_rebuild(). */
+	struct CFTreeRebuilding : public std::exception {};
 
 	enum { fdim = dim }; /** enum for recognizing dimension outside this class. */
 
@@ -79,6 +102,39 @@ public:
 	typedef std::vector<CFEntry*> cfentry_ptr_vec_type; /** vector of cfentry pointers. */
 	typedef float_type (*dist_func_type)(const CFEntry&, const CFEntry&); /** distance function pointer. */
 	typedef std::vector<CFEntry> cfentry_vec_type; /** vector of cfentries. */
+	typedef std::size_t handle_type; /** stable identifier of the subcluster a data-point was inserted into. */
+	enum { invalid_handle = -1 }; /** handle of entries which are not tracked. */
+
+	/** Read-only view of data-points in a row-major array owned by the caller.
+	 *
+	 * rows are stride elements apart, so a view can skip padding or trailing columns without copying anything.
+	 */
+	template<typename T>
+	struct basic_matrix_view
+	{
+		typedef T value_type;
+
+		basic_matrix_view() : data(NULL), rows(0), cols(dim), stride(dim) {}
+		basic_matrix_view( const T* in_data, std::size_t in_rows, std::size_t in_stride = dim ) : data(in_data), rows(in_rows), cols(dim), stride(in_stride) {}
+
+		/** the i-th data-point */
+		const T* operator[]( std::size_t i ) const { return data + i * stride; }
+		/** the i-th data-point, for generic row accessors */
+		const T* operator()( std::size_t i ) const { return data + i * stride; }
+
+		/** rows [begin, end) of this view */
+		basic_matrix_view slice( std::size_t begin, std::size_t end ) const { return basic_matrix_view( (*this)[begin], end - begin, stride ); }
+
+		const T*		data;	/** the first element of the first row */
+		std::size_t		rows;	/** # data-points */
+		std::size_t		cols;	/** # elements per data-point, always dim */
+		std::size_t		stride;	/** # elements between the starts of two consecutive rows */
+	};
+	typedef basic_matrix_view<float_type> matrix_view; /** view of float_type data-points. */
+	typedef basic_matrix_view<float> matrix_view_f32; /** view of float data-points, widened while reading. */
+	typedef basic_matrix_view<boost::int16_t> matrix_view_i16; /** view of int16 data-points, widened while reading. */
+	typedef basic_matrix_view<boost::int8_t> matrix_view_i8; /** view of int8 data-points, widened while reading. */
+	typedef basic_matrix_view<boost::uint8_t> matrix_view_u8; /** view of uint8 data-points, widened while reading. */
 
 	typedef boost::numeric::ublas::vector<float_type>			ublas_vec_type;			/* ublas vector in float_type. */
 	typedef boost::numeric::ublas::symmetric_matrix<float_type>	ublas_sym_matrix_type;	/* ublas symmetric matrix in float_type. */
@@ -89,24 +145,22 @@ public:
 	struct CFEntry
 	{
 		/** Empty construct initialized with zeros */
-		CFEntry() : n(0), sum_sq(0.0), child(NULL)
+		CFEntry() : n(0), sum_sq(0.0), child(NULL), handle((handle_type)invalid_handle)
 		{
 			std::fill(sum, sum + dim, 0);
 		}
 
 		/** Constructor when array of T type items come.
-		 * initialize CFEntry with one data-point
+		 * initialize CFEntry with one data-point, narrower types are widened to float_type in registers
 		 */
 		template<typename T>
-		CFEntry( T* item ) : n(1), sum_sq(0.0), child(NULL)
+		CFEntry( T* item ) : n(1), sum_sq(0.0), child(NULL), handle((handle_type)invalid_handle)
 		{
-			std::copy( item, item + dim, sum );
-			for( std::size_t i = 0 ; i < dim ; i++ )
-				sum_sq += item[i] * item[i];
+			sum_sq = _widen_item( item, sum );
 		}
 
 		/** Constructor for root entry with children */
-		CFEntry( CFNode* in_child ) : n(0), sum_sq(0.0), child(in_child)
+		CFEntry( CFNode* in_child ) : n(0), sum_sq(0.0), child(in_child), handle((handle_type)invalid_handle)
 		{
 			std::fill(sum, sum + dim, 0);
 		}
@@ -154,6 +208,7 @@ public:
 		float_type			sum[dim];	/* linear sum of each dimension of n data-points */
 		float_type			sum_sq;		/* square sum of n data-points */
 		CFNode*					child;		/* pointer to a child node */
+		handle_type				handle;		/* subcluster handle of a leaf entry, if handles are tracked */
 	};
 
 	/** CFNode is composed of several CFEntries within page-size, and acts like B-tree node.
@@ -165,7 +220,8 @@ public:
 	 */
 	struct CFNode
 	{
-		CFNode() : size(0) {}
+		CFNode() : size(0), id(0), pos(0), dirty(false), threshold(0.0) {}
+		virtual ~CFNode() {}
 		virtual bool IsLeaf() const = 0;
 
 		/** add new CFEntry to this CFNode */
@@ -209,7 +265,11 @@ public:
 		}
 
 		std::size_t		size;	/** # CFEntries this CFNode contains */
-		CFEntry			entries[(PAGE_SIZE - ( sizeof(CFNodeLeaf*)*2 /* 2 leaf node pointers */ + sizeof(std::size_t) /* size */ + sizeof(void*) /* vtptr */ )) / sizeof(CFEntry)/*max_entries*/]; /** Array of CFEntries */
+		std::size_t		id;		/** persistent node id, see CFTree_Snapshot.h */
+		std::size_t		pos;	/** index in the nodes of the tree, see _free_nodes() */
+		bool			dirty;	/** changed since the last checkpoint */
+		float_type		threshold;	/** absorption threshold of a subtree rebuilt apart, 0 for the tree's, see rebuild_partially() */
+		CFEntry			entries[(PAGE_SIZE - ( sizeof(CFNodeLeaf*)*2 /* 2 leaf node pointers */ + sizeof(std::size_t)*3 /* size, id, pos */ + sizeof(float_type)*2 /* dirty padded, threshold */ + sizeof(void*) /* vtptr */ )) / sizeof(CFEntry)/*max_entries*/]; /** Array of CFEntries */
 	};
 
 	/** CFNode which is intermediate */
@@ -228,19 +288,105 @@ public:
 		CFNode* prev;	/** previous CFNode */
 		CFNode* next;  /** next CFNode */
 	};
+	static_assert( sizeof(CFNodeLeaf) <= PAGE_SIZE, "a leaf must fit in a page" );
 	
 private:
-	
+
+	/** two consecutive elements, widened to doubles in a register */
+	static __m128d _load_pd(const double* p) { return _mm_loadu_pd(p); }
+
+	static __m128d _load_pd(const float* p) { return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)p))); }
+
+	static __m128d _load_pd(const boost::int16_t* p) {
+		int bits;
+		std::memcpy(&bits, p, sizeof(bits));
+		const __m128i v = _mm_cvtsi32_si128(bits);
+		return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+	}
+
+	static __m128d _load_pd(const boost::int8_t* p) {
+		boost::uint16_t bits;
+		std::memcpy(&bits, p, sizeof(bits));
+		const __m128i v = _mm_cvtsi32_si128(bits);
+		const __m128i v16 = _mm_unpacklo_epi8(v, v);
+		return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(v16, v16), 24));
+	}
+
+	static __m128d _load_pd(const boost::uint8_t* p) {
+		boost::uint16_t bits;
+		std::memcpy(&bits, p, sizeof(bits));
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v = _mm_cvtsi32_si128(bits);
+		return _mm_cvtepi32_pd(_mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero));
+	}
+
+	/** any other arithmetic type */
+	template<typename T>
+	static __m128d _load_pd(const T* p) { return _mm_set_pd((double)p[1], (double)p[0]); }
+
+	/** copy one data-point widening it to doubles, and return its square sum */
+	template<typename T>
+	static double _widen_item(const T* item, double* out) {
+		__m128d sq = _mm_setzero_pd();
+		std::size_t i = 0;
+		for (; i + 2 <= dim; i += 2) {
+			const __m128d v = _load_pd(item + i);
+			_mm_storeu_pd(out + i, v);
+			sq = _mm_add_pd(sq, _mm_mul_pd(v, v));
+		}
+
+		double result = _mm_cvtsd_f64(_mm_hadd_pd(sq, sq));
+
+		for (; i < dim; i++) {
+			out[i] = (double)item[i];
+			result += out[i] * out[i];
+		}
+		return result;
+	}
+
+	/** add one data-point to doubles, widening it on the fly */
+	template<typename T>
+	static void _add_widened(const T* item, double* sum) {
+		std::size_t i = 0;
+		for (; i + 2 <= dim; i += 2)
+			_mm_storeu_pd(sum + i, _mm_add_pd(_mm_loadu_pd(sum + i), _load_pd(item + i)));
+		for (; i < dim; i++)
+			sum[i] += (double)item[i];
+	}
+
+	/** square sum of one data-point */
+	template<typename T>
+	static double _sq_norm(const T* item) {
+		__m128d sq = _mm_setzero_pd();
+		std::size_t i = 0;
+		for (; i + 2 <= dim; i += 2) {
+			const __m128d v = _load_pd(item + i);
+			sq = _mm_add_pd(sq, _mm_mul_pd(v, v));
+		}
+
+		double result = _mm_cvtsd_f64(_mm_hadd_pd(sq, sq));
+
+		for (; i < dim; i++)
+			result += (double)item[i] * (double)item[i];
+		return result;
+	}
+
 	static const double euclidean_intrinsic_double(int n, const double* x, const double* y, double xm, double ym) {
+		return euclidean_intrinsic(n, x, y, xm, ym);
+	}
+
+	/** squared euclidean distance between x*xm and y*ym, x of any input type is widened to doubles in registers */
+	template<typename T>
+	static const double euclidean_intrinsic(int n, const T* x, const double* y, double xm, double ym) {
 		__m128d euclidean0 = _mm_setzero_pd();
 		__m128d euclidean1 = _mm_setzero_pd();
 		__m128d mula = _mm_set_pd1(xm);
 		__m128d mulb = _mm_set_pd1(ym);
 
 		for (; n > 3; n -= 4) {
-			const __m128d a0 = _mm_loadu_pd(x);
+			const __m128d a0 = _load_pd(x);
 			x += 2;
-			const __m128d a1 = _mm_loadu_pd(x);
+			const __m128d a1 = _load_pd(x);
 			x += 2;
 
 			const __m128d b0 = _mm_loadu_pd(y);
@@ -267,7 +413,13 @@ private:
 
 		const __m128d sum = _mm_hadd_pd(euclidean, euclidean);
 
-		double result = sum.m128d_f64[0];
+		double result = _mm_cvtsd_f64(sum);
+
+		// remaining dimensions when n is not a multiple of 4
+		for (; n > 0; n--, x++, y++) {
+			const double d = (double)*x * xm - *y * ym;
+			result += d * d;
+		}
 
 		return result;
 	}
@@ -412,7 +564,8 @@ public:
 	 **/
 	CFTree( float_type in_dist_threshold, std::size_t in_k_limit, uint32_t in_rebuild_interval, dist_func_type in_dist_func = _DistD0, dist_func_type in_absorb_dist_func = _DistD0  ) :
 		k_limit(in_k_limit), dist_threshold(in_dist_threshold), rebuild_interval(in_rebuild_interval), rebuild_pos(0), root(new CFNodeLeaf()), dist_func(in_dist_func), absorb_dist_func(in_absorb_dist_func), node_cnt(1/* root node */),
-		leaf_dummy( new CFNodeLeaf() )
+		leaf_dummy( new CFNodeLeaf() ), handles_tracked(false), inserted_handle((handle_type)invalid_handle), entry_added(false),
+		next_node_id(1/* root node */), dirty_tracked(false), handles_checkpointed(0), background_rebuilds(false), background(NULL), retired(NULL), migration_budget(0), migration(NULL), bulk_rebuilds(false), rebuild_fill(0.75), absorb_ratio(0.5), predicted_from(0), predicted_fraction(0.0), overflowing(false), overflow_rebuilds(0), warm_up_points(0), overflow_bound(0.0), overflow_diameter(true), merge_refinement(false), refinement_merges(0), refinement_resplits(0), partial_rebuilds(false), checkpoint_generation(0), checkpoint_seq(0), checkpoint_base_bytes(0), checkpoint_log_bytes(0)
 	{
 		((CFNodeLeaf*)leaf_dummy)->next = root;
 		nodes = new(cfnode_ptr_vec_type);
@@ -424,6 +577,18 @@ public:
 
 	void clear(void)
 	{
+		// a background rebuild reads the nodes, its result is dropped
+		delete background;
+		background = NULL;
+		delete retired;
+		retired = NULL;
+		if( migration )
+		{
+			delete migration->old;
+			delete migration;
+			migration = NULL;
+		}
+
 		if(nodes)
 		{
 			for (size_t i = 0; i < nodes->size(); ++i)
@@ -432,6 +597,7 @@ public:
 			delete nodes;
 			nodes = NULL;
 		}
+		_clear_dirty_nodes();
 
 		if (leaf_dummy)
 		{
@@ -447,35 +613,297 @@ public:
 	}
 
 	/** whether this CFTree is empty or not */
-	bool empty() const { return root->IsEmpty(); }
+	bool empty() const { return root->IsEmpty() && warm_up_entries.empty() && _migrating_root() == NULL; }
+
+	/** start or stop tracking subcluster handles.
+	 *
+	 * while tracking, insert() returns the handle of the leaf entry which took the data-point.
+	 * a handle stays valid through rebuilds, which only merge leaf entries,
+	 * and resolve_handle() turns it into a final cluster after cluster().
+	 */
+	void track_handles( bool track ) { handles_tracked = track; }
+
+	/** # handles given so far, handles being numbered from 0 */
+	std::size_t handle_count() const { return background ? background->handle_base + background->side->handle_count() : handle_parent.size(); }
+
+	/** start or stop rebuilding in the background.
+	 *
+	 * once the leaf entries overflow k_limit, insert() leaves the tree to a task rebuilding it
+	 * and takes the next data-points into a small side tree; the first insert() after the task is over
+	 * swaps the rebuilt tree in and replays the side tree into it, so insertions don't wait for rebuilds.
+	 */
+	void rebuild_in_background( bool enable ) { background_rebuilds = enable; }
+
+	/** start or stop spreading rebuilds over insertions, 0 to stop.
+	 *
+	 * once the leaf entries overflow k_limit, the tree starts over empty and every insert() does at most
+	 * budget steps of the rebuild besides its own insertion: first measuring the next threshold over the leaves
+	 * of the previous tree, then moving its leaf entries, then deleting its nodes. meant for a single core,
+	 * where a background rebuild would only take turns with insertions.
+	 */
+	void rebuild_incrementally( std::size_t budget ) { migration_budget = budget; }
+
+	/** start or stop bulk-loading rebuilds.
+	 *
+	 * instead of inserting the leaf entries one by one, a rebuild merges close entries among their neighbours
+	 * and packs what is left bottom-up into full nodes, in parallel, see CFTree_BulkLoad.h.
+	 * much faster on large trees, though entries are only compared with a few neighbours instead of a leaf each.
+	 */
+	void rebuild_in_bulk( bool enable ) { bulk_rebuilds = enable; }
+
+	/** rebuilding only the densest subtrees when the leaf entries outgrow k_limit, if they hold enough of them.
+	 *
+	 * subtrees with more leaf entries than the average, below the root, are rebuilt apart under a raised threshold
+	 * of their own, kept in their nodes, so that the cost of a rebuild goes with the dense region rather than the tree.
+	 * the whole tree is rebuilt as before when the dense subtrees can't shed the surplus or one of them would need
+	 * a level more, and a whole rebuild brings every subtree back to the tree's threshold.
+	 */
+	void rebuild_partially( bool enable ) { partial_rebuilds = enable; }
+
+	/** statistics of the rebuilds triggered by k_limit */
+	struct rebuild_stats
+	{
+		rebuild_stats() : overflows(0), rebuilds(0), max_rebuilds(0), predicted_entries(0), rebuilt_entries(0), leaf_merges(0), partial_rebuilds(0) {}
+
+		/** average # rebuilds it took to bring the leaf entries back under k_limit */
+		double rebuilds_per_overflow() const { return overflows > 0 ? (double)rebuilds / overflows : 0.0; }
+
+		std::size_t	overflows;			/* # times the leaf entries outgrew k_limit */
+		std::size_t	rebuilds;			/* # rebuilds they took */
+		std::size_t	max_rebuilds;		/* most rebuilds one overflow took */
+		std::size_t	predicted_entries;	/* # leaf entries the last predicted threshold was meant to leave */
+		std::size_t	rebuilt_entries;	/* # leaf entries it left */
+		std::size_t	leaf_merges;		/* # full leaves which merged two entries instead of splitting, see merge_on_overflow() */
+		std::size_t	partial_rebuilds;	/* # rebuilds of dense subtrees alone, see rebuild_partially() */
+	};
+	const rebuild_stats& get_rebuild_stats() const { return stats; }
+
+	/** occupancy of the nodes, see merging_refinement() */
+	struct occupancy_stats
+	{
+		occupancy_stats() : nodes(0), leaves(0), depth(0), entries(0), leaf_entries(0), refinement_merges(0), refinement_resplits(0) {}
+
+		/** average share of the entry slots in use, over every node or over the leaves */
+		double fill() const { return nodes > 0 ? (double)entries / ( nodes * max_leaf_entries ) : 0.0; }
+		double leaf_fill() const { return leaves > 0 ? (double)leaf_entries / ( leaves * max_leaf_entries ) : 0.0; }
+
+		std::size_t	nodes;					/* # nodes, leaves included */
+		std::size_t	leaves;
+		std::size_t	depth;					/* # levels */
+		std::size_t	entries;				/* # entries of every node */
+		std::size_t	leaf_entries;
+		std::size_t	refinement_merges;		/* # pairs of nodes merged into one after splits */
+		std::size_t	refinement_resplits;	/* # pairs of nodes too full to merge, whose entries were split again */
+	};
+	occupancy_stats get_occupancy_stats() const
+	{
+		occupancy_stats occ;
+		occ.refinement_merges = refinement_merges;
+		occ.refinement_resplits = refinement_resplits;
+		std::vector<const CFNode*> level( 1, root ), next;
+		while( !level.empty() )
+		{
+			occ.depth++;
+			next.clear();
+			for( std::size_t i = 0 ; i < level.size() ; i++ )
+			{
+				const CFNode* node = level[i];
+				occ.nodes++;
+				occ.entries += node->size;
+				if( node->IsLeaf() )
+				{
+					occ.leaves++;
+					occ.leaf_entries += node->size;
+				}
+				else
+					for( std::size_t j = 0 ; j < node->size ; j++ )
+						next.push_back( node->entries[j].child );
+			}
+			level.swap( next );
+		}
+		return occ;
+	}
+
+	/** average distance of leaf entries to their closest neighbours in the same leaf, which extending rebuilds start from */
+	struct closest_dist_estimate
+	{
+		closest_dist_estimate() : mean(0.0), lower(0.0), upper(0.0), sampled_leaves(0), leaves(0) {}
+
+		float_type	mean;
+		float_type	lower;			/* confidence bounds of mean, equal to it if every leaf was measured */
+		float_type	upper;
+		std::size_t	sampled_leaves;	/* # leaves measured */
+		std::size_t	leaves;			/* # leaves of the tree */
+	};
+
+	/** estimating the average closest-pair distance of leaf entries from every stride-th leaf, in parallel.
+	 *
+	 * leaves are the sampling units: the mean is the ratio of the sampled distance sums to the sampled entries,
+	 * whose variance gives the bounds.
+	 * @param max_leaves	# leaves to measure at most, 0 for all of them
+	 * @param z				standard score of the bounds, 1.96 for 95% confidence
+	 */
+	closest_dist_estimate estimate_closest_dist( std::size_t max_leaves = 0, float_type z = 1.96 ) const
+	{
+		closest_dist_estimate est;
+		std::vector<const CFNodeLeaf*> leaves;
+		est.leaves = _sample_leaves( 1, leaves );
+		if( max_leaves > 0 && est.leaves > max_leaves )
+		{
+			std::size_t stride = ( est.leaves + max_leaves - 1 ) / max_leaves;
+			for( std::size_t i = 0 ; i * stride < leaves.size() ; i++ )
+				leaves[i] = leaves[i * stride];
+			leaves.resize( ( leaves.size() + stride - 1 ) / stride );
+		}
+		est.sampled_leaves = leaves.size();
+		std::vector<float_type> sums( leaves.size() );
+		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, leaves.size(), closest_grain_size ), _closest_sum_body( *this, leaves, sums ) );
+
+		float_type total_d = 0.0;
+		std::size_t total_n = 0;
+		for( std::size_t i = 0 ; i < leaves.size() ; i++ )
+		{
+			total_d += sums[i];
+			total_n += leaves[i]->size >= 2 ? leaves[i]->size : 0;
+		}
+		if( total_n == 0 )
+			return est;
+		est.mean = est.lower = est.upper = total_d / total_n;
+
+		// variance of a ratio estimator over leaves sampled without replacement
+		const std::size_t m = leaves.size();
+		if( m < 2 || m == est.leaves )
+			return est;
+		float_type residuals = 0.0;
+		for( std::size_t i = 0 ; i < m ; i++ )
+		{
+			float_type r = sums[i] - est.mean * ( leaves[i]->size >= 2 ? leaves[i]->size : 0 );
+			residuals += r * r;
+		}
+		float_type mean_n = (float_type)total_n / m;
+		float_type var = ( 1.0 - (float_type)m / est.leaves ) * residuals / ( (m - 1) * m * mean_n * mean_n );
+		float_type margin = z * sqrt( var );
+		est.lower = (std::max)( est.mean - margin, (float_type)0.0 );
+		est.upper = est.mean + margin;
+		return est;
+	}
+
+	/** # leaf entries rebuilds triggered by k_limit aim at, as a fraction of k_limit, 0.75 by default.
+	 *
+	 * the threshold of such a rebuild is predicted from the distances between sampled leaf entries and their neighbours,
+	 * so that one rebuild normally suffices; the margin left under k_limit makes up for errors of the prediction.
+	 */
+	void rebuild_target( float_type fill ) { rebuild_fill = fill; }
+
+	/** merging two entries of a full leaf instead of splitting it, bound being 0 to stop.
+	 *
+	 * when a full leaf doesn't absorb a data-point, the closest pair among its entries and the data-point is merged
+	 * as long as the diameter, or the radius, of the merged entry stays under bound * the threshold, which makes room
+	 * for the data-point unless it is part of the pair. like the merging refinement of the paper, but local:
+	 * leaves split less and the tree reaches k_limit later, at the cost of entries a little over the threshold.
+	 * entries absorbing data-points within the threshold of their centroids have diameters up to about twice it
+	 * and radii up to about the threshold, so bounds of 3 for the diameter or 1.5 for the radius are mild.
+	 */
+	void merge_on_overflow( float_type bound, bool diameter = true )
+	{
+		overflow_bound = bound;
+		overflow_diameter = diameter;
+	}
+
+	/** merging refinement of the paper, after splits.
+	 *
+	 * in the node where a split stops, the two closest entries are merged with their child nodes unless they are
+	 * the pair of the split, the entries being split again if they don't fit into one node. nodes fill up more,
+	 * so the tree takes fewer nodes, less memory and shorter descents, against a closest-pair search per split.
+	 * nodes of 2 entries, e.g. at dim 192, only ever hold the split pair there, so nothing is merged.
+	 */
+	void merging_refinement( bool enable ) { merge_refinement = enable; }
+
+	/** buffering the first n_points data-points to start from a threshold fit for k_limit, 0 to stop buffering.
+	 *
+	 * once n_points are buffered, or anything reads the tree, the threshold is raised to the one expected to leave
+	 * rebuild_target() * k_limit leaf entries, estimated from the closest-neighbour distances of a sample of the buffer,
+	 * and the buffer is bulk-loaded, so a threshold of 0 doesn't start with a cascade of rebuilds. a buffer of fewer
+	 * than k_limit data-points has its distances extrapolated to k_limit of them.
+	 * only an empty tree with a k_limit warms up; insert() returns the handles of buffered data-points right away.
+	 */
+	void warm_up( std::size_t n_points )
+	{
+		warm_up_points = k_limit > 0 && root->IsEmpty() ? n_points : 0;
+		if( warm_up_entries.size() >= warm_up_points )
+			_end_warm_up();
+	}
+
+	/** whether a background or incremental rebuild is under way, see finish_rebuild() */
+	bool rebuilding() const { return background != NULL || migration != NULL; }
+
+	/** waiting for a background rebuild, or completing an incremental one, if any.
+	 *
+	 * everything but insert() changing the whole tree calls it first. reads of the leaf entries, get_entries(),
+	 * cluster(), route() and estimate_closest_dist(), go over an incremental rebuild instead, see _leaf_spans().
+	 */
+	void finish_rebuild()
+	{
+		_finish_background();
+		while( migration )
+			_migrate( (std::numeric_limits<std::size_t>::max)() );
+	}
 
 	/** inserting one data-point */
-	void insert( item_vec_type& item )
+	handle_type insert( item_vec_type& item )
 	{
 		if( item.size() != dim )
 			throw CFTreeInvalidItemSize();
 
-		insert(&item[0]);
+		return insert(&item[0]);
 	}
 
 	/** inserting one data-point with T typed */
 	template<typename T>
-	void insert(T* item)
+	handle_type insert(T* item)
 	{
 		CFEntry e(item);
-		insert(e);
+		return insert(e);
 	}
 
-	/** inserting a new entry */
-	void insert( CFEntry& e )
+	/** inserting a new entry
+	 *
+	 * @return handle of the subcluster e went into, invalid_handle if handles are not tracked
+	 */
+	handle_type insert( CFEntry& e )
 	{
-		bool bsplit;
-		insert(root, e, bsplit);
+		_invalidate_leaf_map();
 
-		// there's no exception for the root as regard to splitting, indeed
-		if( bsplit )
+		// the first data-points wait in the warm-up buffer, with their handles
+		if( warm_up_points > 0 )
 		{
-			split_root( e );
+			_assign_handle( e );
+			warm_up_entries.push_back( e );
+			if( warm_up_entries.size() >= warm_up_points )
+				_end_warm_up();
+			return e.handle;
+		}
+
+		// while the tree is rebuilt in the background, data-points wait in the side tree,
+		// unless it outgrows k_limit before the rebuild is over
+		if( background )
+		{
+			CFTree& side = *background->side;
+			if( !background->done && !(side.rebuild_pos == 0 && !side.empty() && side._leaf_entry_count() > k_limit) )
+			{
+				handle_type h = side.insert( e );
+				return h == (handle_type)invalid_handle ? h : background->handle_base + h;
+			}
+			finish_rebuild();
+		}
+
+		handle_type h = _insert_entry( e );
+
+		// a migrating rebuild moves a few more entries of the previous tree
+		if( migration )
+		{
+			migration->n_kept += entry_added ? 1 : 0;
+			_migrate( migration_budget );
 		}
 
 		if (++rebuild_pos >= rebuild_interval)
@@ -484,16 +912,62 @@ public:
 
 			for (;;)
 			{
-				std::size_t n_leaf_entries = 0;
-				for (leaf_iterator it = leaf_begin(); it != leaf_end(); ++it)
-					n_leaf_entries += it->size;
-
-				if (k_limit <= 0 || n_leaf_entries <= k_limit)
+				if (migration || k_limit <= 0)
 					break;
+				std::size_t n_entries = _leaf_entry_count();
+				if (n_entries <= k_limit)
+				{
+					overflowing = false;
+					break;
+				}
+				_count_rebuilds( 1 );
 
+				// the dense subtrees alone, once per overflow
+				if (partial_rebuilds && overflow_rebuilds == 1 && _rebuild_dense())
+					continue;
+				if (migration_budget > 0)
+				{
+					_start_migration( n_entries );
+					break;
+				}
+				if (background_rebuilds)
+				{
+					_start_rebuild();
+					break;
+				}
 				rebuild();
 			}
 		}
+
+		return h;
+	}
+
+	/** inserting a batch of data-points.
+	 *
+	 * insertions into the tree are sequential, but for large batches the entries
+	 * are built on other threads ahead of the insertions, in chunks.
+	 *
+	 * @param out_handles	optional, room for items.rows handles, see track_handles()
+	 */
+	template<typename T>
+	void insert_rows( const basic_matrix_view<T>& items, handle_type* out_handles = NULL )
+	{
+		if( items.rows < 4 * insert_chunk_rows )
+		{
+			for( std::size_t i = 0 ; i < items.rows ; i++ )
+			{
+				handle_type h = insert( items[i] );
+				if( out_handles )
+					out_handles[i] = h;
+			}
+			return;
+		}
+
+		std::size_t next_row = 0;
+		tbb::parallel_pipeline( 2 * tbb::info::default_concurrency(),
+			tbb::make_filter<void, _insert_chunk*>( tbb::filter_mode::serial_in_order, _chunk_input< basic_matrix_view<T> >( items, next_row ) ) &
+			tbb::make_filter<_insert_chunk*, _insert_chunk*>( tbb::filter_mode::parallel, _chunk_build< basic_matrix_view<T> >( items ) ) &
+			tbb::make_filter<_insert_chunk*, void>( tbb::filter_mode::serial_in_order, _chunk_insert( *this, out_handles ) ) );
 	}
 
 	/** get the beginning of leaf iterators */
@@ -504,25 +978,100 @@ public:
 	/** get leaf entries */
 	void get_entries( cfentry_vec_type& out_entries )
 	{
+		_finish_background();
+
+		std::vector<leaf_span> spans;
+		_leaf_spans( spans );
 		std::size_t n_leaf_entries = 0;
-		leaf_iterator it = leaf_begin();
-		for( leaf_iterator it = leaf_begin() ; it != leaf_end() ; ++it)
-			n_leaf_entries += it->size;
+		for( std::size_t i = 0 ; i < spans.size() ; i++ )
+			n_leaf_entries += spans[i].leaf->size - spans[i].begin;
 
 		out_entries.clear();
 		out_entries.reserve(n_leaf_entries);
-		for( leaf_iterator it = leaf_begin() ; it != leaf_end() ; ++it )
-			std::copy( it->entries, it->entries + it->size, std::back_inserter(out_entries) );
+		for( std::size_t i = 0 ; i < spans.size() ; i++ )
+			std::copy( spans[i].leaf->entries + spans[i].begin, spans[i].leaf->entries + spans[i].leaf->size, std::back_inserter(out_entries) );
 	}
 
 private:
+	enum { insert_chunk_rows = 256 }; /** # data-points per chunk of insert_rows() */
+
+	/** rows [begin, end) of a batch and their entries */
+	struct _insert_chunk
+	{
+		_insert_chunk( std::size_t in_begin, std::size_t in_end ) : begin(in_begin), end(in_end) {}
+
+		std::size_t			begin;
+		std::size_t			end;
+		cfentry_vec_type	entries;
+	};
+
+	template<typename view_type>
+	struct _chunk_input
+	{
+		_chunk_input( const view_type& in_items, std::size_t& in_next_row ) : items(in_items), next_row(in_next_row) {}
+
+		_insert_chunk* operator()( tbb::flow_control& fc ) const
+		{
+			if( next_row >= items.rows )
+			{
+				fc.stop();
+				return NULL;
+			}
+			std::size_t begin = next_row;
+			next_row = (std::min)( items.rows, next_row + insert_chunk_rows );
+			return new _insert_chunk( begin, next_row );
+		}
+
+		const view_type&	items;
+		std::size_t&		next_row;
+	};
+
+	template<typename view_type>
+	struct _chunk_build
+	{
+		_chunk_build( const view_type& in_items ) : items(in_items) {}
+
+		_insert_chunk* operator()( _insert_chunk* chunk ) const
+		{
+			chunk->entries.reserve( chunk->end - chunk->begin );
+			for( std::size_t i = chunk->begin ; i < chunk->end ; i++ )
+				chunk->entries.push_back( CFEntry( items[i] ) );
+			return chunk;
+		}
+
+		const view_type& items;
+	};
+
+	struct _chunk_insert
+	{
+		_chunk_insert( CFTree& in_tree, handle_type* in_out_handles ) : tree(in_tree), out_handles(in_out_handles) {}
+
+		void operator()( _insert_chunk* chunk ) const
+		{
+			for( std::size_t i = 0 ; i < chunk->entries.size() ; i++ )
+			{
+				handle_type h = tree.insert( chunk->entries[i] );
+				if( out_handles )
+					out_handles[chunk->begin + i] = h;
+			}
+			delete chunk;
+		}
+
+		CFTree&			tree;
+		handle_type*	out_handles;
+	};
 
 	void insert( CFNode* node, CFEntry& new_entry, bool &bsplit )
 	{
+		// every node on the path takes the new entry one way or another
+		_touch( node );
+
 		// empty node, it might be root node at first insertion
 		if( node->IsEmpty() )
 		{
+			_assign_handle(new_entry);
 			node->Add(new_entry);
+			entry_added = true;
 			bsplit = false;
 			return;
 		}
@@ -539,87 +1088,319 @@ private:
 				close_entry += (new_entry);
 			// split here
 			else
+			{
 				split( *node, close_entry, new_entry, bsplit );
+
+				// the split stops here, the new pair being close_entry and the last entry
+				if( !bsplit && merge_refinement )
+					_refine_merge( *node, &close_entry - node->entries, node->size - 1 );
+			}
 		}
 		//leaf
 		else
 		{
 			// absorb
-			if ( absorb_dist_func(close_entry, new_entry) < dist_threshold  )
+			if ( absorb_dist_func(close_entry, new_entry) < (std::max)( node->threshold, dist_threshold ) )
 			{
+				_merge_handle(close_entry, new_entry);
 				close_entry += (new_entry);
 				bsplit = false;
 			}
 			// add new_entry
 			else if( node->size < node->MaxEntrySize() )
 			{
+				_assign_handle(new_entry);
 				node->Add(new_entry);
+				entry_added = true;
+				bsplit = false;
+			}
+			// merge within the leaf instead of splitting it
+			else if( overflow_bound > 0.0 && _merge_closest_pair( *node, close_entry, new_entry ) )
+			{
 				bsplit = false;
 			}
 			// handle with the split cond. at parent-level
 			else
 			{
+				_assign_handle(new_entry);
+				entry_added = true;
 				bsplit = true;
 			}
 		}
 	}
 
-	CFEntry* find_close( CFNode* node, CFEntry& new_entry )
+	/** merging the closest pair among the entries of a full leaf and new_entry, close_entry being the closest to it.
+	 *
+	 * @return false if the merged entry would outgrow overflow_bound, leaving node unchanged
+	 */
+	bool _merge_closest_pair( CFNode& node, CFEntry& close_entry, CFEntry& new_entry )
 	{
-		CFEntry* begin = node->entries;
-		CFEntry* end = begin + node->size;
-		CFEntry* e = std::min_element( begin, end, CloseEntryLessThan(new_entry, dist_func) );
-		return e != end ? e : NULL;
+		float_type min_dists[max_leaf_entries];
+		std::size_t closest[max_leaf_entries];
+		_closest_in_leaf( node.entries, node.size, min_dists, closest );
+		std::size_t i = 0;
+		for( std::size_t k = 1 ; k < node.size ; k++ )
+			if( min_dists[i] > min_dists[k] )
+				i = k;
+
+		const float_type bound = overflow_bound * (std::max)( node.threshold, dist_threshold );
+		if( dist_func( close_entry, new_entry ) <= min_dists[i] )
+		{
+			CFEntry merged = close_entry + new_entry;
+			if( ( overflow_diameter ? _Diameter( merged ) : _Radius( merged ) ) >= bound )
+				return false;
+			_merge_handle( close_entry, new_entry );
+			close_entry += new_entry;
+		}
+		else
+		{
+			CFEntry& lhs = node.entries[i];
+			CFEntry& rhs = node.entries[closest[i]];
+			CFEntry merged = lhs + rhs;
+			if( ( overflow_diameter ? _Diameter( merged ) : _Radius( merged ) ) >= bound )
+				return false;
+			_merge_handle( lhs, rhs );
+			lhs += rhs;
+			rhs = node.entries[--node.size];
+			_assign_handle( new_entry );
+			node.Add( new_entry );
+		}
+		stats.leaf_merges++;
+		return true;
 	}
 
-	void split( CFNode& node, CFEntry& close_entry, CFEntry& new_entry, bool& bsplit )
+	/** merging refinement in node, split_lhs and split_rhs being the entries of the split which stopped there */
+	void _refine_merge( CFNode& node, std::size_t split_lhs, std::size_t split_rhs )
 	{
-		CFNode* old_node = close_entry.child;
-		assert( old_node != NULL );
+		if( node.size < 3 )
+			return;
 
-		// make the list of entries, old entries
+		float_type min_dists[max_leaf_entries];
+		std::size_t closest[max_leaf_entries];
+		_closest_in_leaf( node.entries, node.size, min_dists, closest );
+		std::size_t i = 0;
+		for( std::size_t k = 1 ; k < node.size ; k++ )
+			if( min_dists[i] > min_dists[k] )
+				i = k;
+		std::size_t j = closest[i];
+		if( ( i == split_lhs && j == split_rhs ) || ( i == split_rhs && j == split_lhs ) )
+			return;
+
+		CFNode* lhs = node.entries[i].child;
+		CFNode* rhs = node.entries[j].child;
+		_touch( lhs );
+		_touch( rhs );
+
+		// the two nodes fit into one, the right one goes
+		if( lhs->size + rhs->size <= lhs->MaxEntrySize() )
+		{
+			std::copy( rhs->entries, rhs->entries + rhs->size, lhs->entries + lhs->size );
+			lhs->size += rhs->size;
+			lhs->threshold = (std::max)( lhs->threshold, rhs->threshold );
+			node.entries[i] += node.entries[j];
+			node.entries[j] = node.entries[--node.size];
+			_free_nodes( std::vector<CFNode*>( 1, rhs ) );
+			refinement_merges++;
+			return;
+		}
+
+		// otherwise their entries are split again, between the farthest pair of them
+		cfentry_vec_type old_entries( lhs->entries, lhs->entries + lhs->size );
+		old_entries.insert( old_entries.end(), rhs->entries, rhs->entries + rhs->size );
 		cfentry_ptr_vec_type entries;
-		entries.reserve( old_node->size + 1 );
-		for( std::size_t i = 0 ; i < old_node->size; i++ )
-			entries.push_back(&old_node->entries[i]);
-		entries.push_back(&new_entry);
+		entries.reserve( old_entries.size() );
+		for( std::size_t k = 0 ; k < old_entries.size() ; k++ )
+			entries.push_back( &old_entries[k] );
 
-		// find the farthest entry pair
 		cfentry_pair_type far_pair;
 		find_farthest_pair( entries, far_pair );
 
-		bool node_is_leaf = old_node->IsLeaf();
-
-		// make two split nodes
-		CFNode* node_lhs = node_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd();
-		CFNode* node_rhs = node_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd();
-
-		nodes->push_back(node_lhs);
-		nodes->push_back(node_rhs);
+		lhs->size = 0;
+		rhs->size = 0;
+		CFEntry entry_lhs( lhs );
+		CFEntry entry_rhs( rhs );
+		rearrange( entries, far_pair, entry_lhs, entry_rhs );
+		node.entries[i] = entry_lhs;
+		node.entries[j] = entry_rhs;
+		refinement_resplits++;
+	}
 
-		// two entries for new root node
-		// and connect child node to the entries
-		CFEntry entry_lhs( node_lhs );
-		CFEntry entry_rhs( node_rhs );
+	/** deleting nodes merged away or rebuilt, out of the leaf links, the nodes and the checkpoints, O(1) per node */
+	void _free_nodes( const std::vector<CFNode*>& freed )
+	{
+		for( std::size_t i = 0 ; i < freed.size() ; i++ )
+		{
+			if( !freed[i]->IsLeaf() )
+				continue;
+			CFNodeLeaf* leaf = (CFNodeLeaf*)freed[i];
+			((CFNodeLeaf*)leaf->prev)->next = leaf->next;
+			if( leaf->prev != leaf_dummy )
+				_touch( leaf->prev );
+			if( leaf->next != NULL )
+			{
+				((CFNodeLeaf*)leaf->next)->prev = leaf->prev;
+				_touch( leaf->next );
+			}
+		}
 
-		if( node_is_leaf )
+		for( std::size_t i = 0 ; i < freed.size() ; i++ )
 		{
-			assert( node_lhs->IsLeaf() && node_rhs->IsLeaf() );
-			
-			CFNodeLeaf* leaf_node = (CFNodeLeaf*)old_node;
+			// the last node takes the place of the freed one
+			CFNode* last = nodes->back();
+			assert( nodes->at(freed[i]->pos) == freed[i] );
+			last->pos = freed[i]->pos;
+			nodes->at(last->pos) = last;
+			nodes->pop_back();
+
+			// dirty_nodes still lists it until the next checkpoint, which skips it
+			if( freed[i]->dirty )
+			{
+				freed[i]->dirty = false;
+				freed_dirty_nodes.push_back( freed[i] );
+			}
+			else
+				delete freed[i];
+		}
+		node_cnt -= freed.size();
+	}
 
-			CFNode* prev = leaf_node->prev;
-			CFNode* next = leaf_node->next;
+	/** node joins the nodes of the tree */
+	void _add_node( CFNode* node )
+	{
+		node->pos = nodes->size();
+		nodes->push_back( node );
+	}
 
-			if( prev != NULL )
-				((CFNodeLeaf*)prev)->next = node_lhs;
-			if( next != NULL )
-				((CFNodeLeaf*)next)->prev = node_rhs;
+	/** forgetting the dirty nodes, e.g. once checkpointed, deleting the ones freed meanwhile */
+	void _clear_dirty_nodes()
+	{
+		dirty_nodes.clear();
+		for( std::size_t i = 0 ; i < freed_dirty_nodes.size() ; i++ )
+			delete freed_dirty_nodes[i];
+		freed_dirty_nodes.clear();
+	}
 
-			((CFNodeLeaf*)node_lhs)->prev = prev;
-			((CFNodeLeaf*)node_lhs)->next = node_rhs;
-			((CFNodeLeaf*)node_rhs)->prev = node_lhs;
-			((CFNodeLeaf*)node_rhs)->next = next;
+	/** a new node with the next persistent id */
+	CFNode* _new_node( bool leaf )
+	{
+		CFNode* node = leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd();
+		node->id = next_node_id++;
+		_touch( node );
+		return node;
+	}
+
+	/** node is about to change, so goes into the next checkpoint */
+	void _touch( CFNode* node )
+	{
+		if( dirty_tracked && !node->dirty )
+		{
+			node->dirty = true;
+			dirty_nodes.push_back( node );
+		}
+	}
+
+	/** a new leaf entry keeps its handle, e.g. while rebuilding, or gets a new one */
+	void _assign_handle( CFEntry& e )
+	{
+		if( handles_tracked && e.handle == (handle_type)invalid_handle )
+		{
+			e.handle = handle_parent.size();
+			handle_parent.push_back( e.handle );
+		}
+		inserted_handle = e.handle;
+	}
+
+	/** e is absorbed by leaf entry, so is its handle */
+	void _merge_handle( CFEntry& leaf_entry, CFEntry& e )
+	{
+		if( handles_tracked )
+		{
+			// entries made before tracking started have no handle yet
+			if( leaf_entry.handle == (handle_type)invalid_handle )
+			{
+				leaf_entry.handle = handle_parent.size();
+				handle_parent.push_back( leaf_entry.handle );
+			}
+			// handles of leaf entries are always roots of their sets
+			if( e.handle != (handle_type)invalid_handle )
+			{
+				handle_parent[e.handle] = leaf_entry.handle;
+				if( dirty_tracked && e.handle < handles_checkpointed )
+					dirty_handles.push_back( e.handle );
+			}
+		}
+		inserted_handle = leaf_entry.handle;
+	}
+
+	/** the handle of the leaf entry which holds data-points of handle h now */
+	handle_type find_handle( handle_type h )
+	{
+		while( handle_parent[h] != h )
+		{
+			// path halving
+			handle_parent[h] = handle_parent[ handle_parent[h] ];
+			h = handle_parent[h];
+		}
+		return h;
+	}
+
+	CFEntry* find_close( CFNode* node, CFEntry& new_entry )
+	{
+		CFEntry* begin = node->entries;
+		CFEntry* end = begin + node->size;
+		CFEntry* e = std::min_element( begin, end, CloseEntryLessThan(new_entry, dist_func) );
+		return e != end ? e : NULL;
+	}
+
+	void split( CFNode& node, CFEntry& close_entry, CFEntry& new_entry, bool& bsplit )
+	{
+		CFNode* old_node = close_entry.child;
+		assert( old_node != NULL );
+
+		// make the list of entries, old entries
+		// copied, because the old node is reused as the left split node
+		cfentry_vec_type old_entries( old_node->entries, old_node->entries + old_node->size );
+		cfentry_ptr_vec_type entries;
+		entries.reserve( old_node->size + 1 );
+		for( std::size_t i = 0 ; i < old_entries.size(); i++ )
+			entries.push_back(&old_entries[i]);
+		entries.push_back(&new_entry);
+
+		// find the farthest entry pair
+		cfentry_pair_type far_pair;
+		find_farthest_pair( entries, far_pair );
+
+		bool node_is_leaf = old_node->IsLeaf();
+
+		// make two split nodes, the left one in place of the old node
+		CFNode* node_lhs = old_node;
+		CFNode* node_rhs = _new_node( node_is_leaf );
+		node_rhs->threshold = old_node->threshold;
+		node_lhs->size = 0;
+		_touch( node_lhs );
+
+		_add_node( node_rhs );
+
+		// two entries for new root node
+		// and connect child node to the entries
+		CFEntry entry_lhs( node_lhs );
+		CFEntry entry_rhs( node_rhs );
+
+		if( node_is_leaf )
+		{
+			assert( node_lhs->IsLeaf() && node_rhs->IsLeaf() );
+			
+			CFNode* next = ((CFNodeLeaf*)node_lhs)->next;
+
+			if( next != NULL )
+			{
+				((CFNodeLeaf*)next)->prev = node_rhs;
+				_touch( next );
+			}
+
+			((CFNodeLeaf*)node_lhs)->next = node_rhs;
+			((CFNodeLeaf*)node_rhs)->prev = node_lhs;
+			((CFNodeLeaf*)node_rhs)->next = next;
 		}
 
 		// rearrange old entries to new entries
@@ -646,10 +1427,12 @@ private:
 	void split_root( CFEntry& e )
 	{
 		// make the list of entries, old entries
+		// copied, because the old root is reused as the left split node
+		cfentry_vec_type old_entries( root->entries, root->entries + root->size );
 		cfentry_ptr_vec_type entries;
 		entries.reserve(root->size + 1);
-		for( std::size_t i = 0 ; i < root->size ; i++ )
-			entries.push_back(&root->entries[i]);
+		for( std::size_t i = 0 ; i < old_entries.size() ; i++ )
+			entries.push_back(&old_entries[i]);
 		entries.push_back(&e);
 
 		// find the farthest entry pair
@@ -658,12 +1441,16 @@ private:
 
 		bool root_is_leaf = root->IsLeaf();
 
-		// make two split nodes
-		CFNode* node_lhs = root_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd();
-		CFNode* node_rhs = root_is_leaf ? (CFNode*) new CFNodeLeaf() : (CFNode*) new CFNodeItmd();
+		// make two split nodes, the left one in place of the old root
+		// it gets a new id, as a child or leaf link to id 0, the root's, reads as none in snapshots
+		CFNode* node_lhs = root;
+		CFNode* node_rhs = _new_node( root_is_leaf );
+		node_lhs->id = next_node_id++;
+		node_lhs->size = 0;
+		_touch( node_lhs );
 
-		nodes->push_back(node_lhs);
-		nodes->push_back(node_rhs);
+		_add_node( node_lhs );
+		_add_node( node_rhs );
 
 		// two entries for new root node
 		// and connect child node to the entries
@@ -671,7 +1458,7 @@ private:
 		CFEntry entry_rhs( node_rhs );
 
 		// new root node result in two entries each of which has split node respectively
-		CFNode* new_root( new CFNodeItmd() );
+		CFNode* new_root( _new_node( false ) );
 
 		// update prev/next links of newly created leaves
 		if( root_is_leaf )
@@ -689,7 +1476,7 @@ private:
 		// substitute new_root to 'root' variable
 		new_root->Add(entry_lhs);
 		new_root->Add(entry_rhs);
-		delete root;
+
 		root = new_root;
 
 		// for statistics and mornitoring memory usage
@@ -712,9 +1499,12 @@ private:
 			float_type dist_first = dist_func( *far_pair.first, e );
 			float_type dist_second = dist_func( *far_pair.second, e );
 
-			CFEntry& e_update = dist_first < dist_second ? entry_lhs : entry_rhs;
-			e_update.child->Add(e);
-			e_update += e;
+			// once a node is full, the rest goes to the other one, which only happens when resplitting
+			CFEntry* e_update = dist_first < dist_second ? &entry_lhs : &entry_rhs;
+			if( e_update->child->IsFull() )
+				e_update = e_update == &entry_lhs ? &entry_rhs : &entry_lhs;
+			e_update->child->Add(e);
+			*e_update += e;
 		}
 	}
 
@@ -742,70 +1532,734 @@ private:
 		}
 	}
 
-	float_type average_dist_closest_pair_leaf_entries()
+	float_type average_dist_closest_pair_leaf_entries() const
 	{
-		std::size_t total_n = 0;
-		float_type	total_d = 0.0;
-		float_type	dist;
+		return estimate_closest_dist().mean;
+	}
 
-		// determine new threshold
-		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy;
-		while( leaf != NULL )
+public:
+	/** rebuild tree from the existing leaf entries.
+	 *
+	 * rebuilding cftree is regarded as clustering, because there could be overlapped cfentries.
+	 * birch guarantees datapoints in cfentries within a range, but two data-points within a range can be separated to different cfentries
+	 *
+	 * @param extend	if true, the size of tree reaches to memory limit, so distance threshold enlarges.
+	 *					in case of both true and false, rebuilding CFTree from the existing leaves.
+	 */
+	void rebuild( bool extend = true )
+	{
+		finish_rebuild();
+		_invalidate_leaf_map();
+
+		// construct a new tree by inserting all the node from the previous tree
+		CFTree<dim> new_tree( extend ? _next_threshold() : dist_threshold, k_limit, rebuild_interval, dist_func, absorb_dist_func );
+		_prepare_rebuilt( new_tree );
+		_consume_leaves( new_tree );
+		_adopt( new_tree );
+		_calibrate( _leaf_entry_count() );
+	}
+
+private:
+	enum { threshold_samples = 4096 }; /** # leaf entries sampled to predict a threshold */
+	enum { closest_grain_size = 16 }; /** # leaves measured by a task */
+	enum { max_leaf_entries = sizeof(CFNode::entries) / sizeof(CFEntry) };
+	enum { min_partial_subtrees = 8 }; /** # subtrees below the root partial rebuilds pick dense ones among, at least */
+
+	/** the threshold of a rebuild extending the range of sub-clusters, predicted if the leaf entries overflow k_limit */
+	float_type _next_threshold()
+	{
+		std::size_t n_entries = _leaf_entry_count();
+		if( k_limit > 0 && n_entries > k_limit )
 		{
-			if( leaf->size >= 2 )
+			std::vector<const CFNodeLeaf*> leaves;
+			_sample_leaves( (std::max)( n_entries / threshold_samples, (std::size_t)1 ), leaves );
+			std::vector<float_type> dists;
+			_closest_dists( leaves, dists );
+			return _predict_threshold( dists, n_entries );
+		}
+		return _next_threshold( average_dist_closest_pair_leaf_entries() );
+	}
+	float_type _next_threshold( float_type average_closest_dist ) const
+	{
+		float_type new_threshold = std::pow(average_closest_dist * 0.5, 2);
+		return dist_threshold > new_threshold ? dist_threshold * 1.05 : new_threshold;
+	}
+
+	/** absorbing distances of the entries of leaf from their closest neighbours in it, as insert() would measure them */
+	void _add_closest_dists( const CFNodeLeaf* leaf, std::vector<float_type>& dists ) const
+	{
+		if( leaf->size < 2 )
+			return;
+
+		std::size_t offset = dists.size();
+		dists.resize( offset + leaf->size );
+		_closest_dists( leaf, &dists[offset] );
+	}
+	void _closest_dists( const CFNodeLeaf* leaf, float_type* dists ) const
+	{
+		_closest_dists( leaf->entries, leaf->size, dists );
+	}
+	void _closest_dists( const CFEntry* entries, std::size_t size, float_type* dists ) const
+	{
+		float_type min_dists[max_leaf_entries];
+		std::size_t closest[max_leaf_entries];
+		_closest_in_leaf( entries, size, min_dists, closest );
+		for( std::size_t i = 0 ; i < size ; i++ )
+			dists[i] = absorb_dist_func( entries[closest[i]], entries[i] );
+	}
+
+	/** dist_func distances of 2 to max_leaf_entries entries to their closest neighbours among them, and which ones these are.
+	 *
+	 * centroids are computed once into stack scratch for the default _DistD0, each pair then taking one run of the SSE kernel.
+	 */
+	void _closest_in_leaf( const CFEntry* entries, std::size_t size, float_type* min_dists, std::size_t* closest ) const
+	{
+		std::fill( min_dists, min_dists + size, (std::numeric_limits<float_type>::max)() );
+		std::fill( closest, closest + size, (std::size_t)0 );
+		if( dist_func == _DistD0 )
+		{
+			float_type centroids[max_leaf_entries][dim];
+			for( std::size_t i = 0 ; i < size ; i++ )
+			{
+				const CFEntry& e = entries[i];
+				float_type inv_n = 1.0/e.n;
+				for( std::size_t k = 0 ; k < dim ; k++ )
+					centroids[i][k] = e.sum[k] * inv_n;
+			}
+			for( std::size_t i = 0 ; i < size - 1 ; i++ )
 			{
-				std::vector<float_type> min_dists( leaf->size, (std::numeric_limits<float_type>::max)() );
-				for( std::size_t i = 0 ; i < leaf->size - 1 ; i++ )
+				for( std::size_t j = i+1 ; j < size ; j++ )
 				{
-					for( std::size_t j = i+1 ; j < leaf->size ; j++ )
-					{
-						dist = dist_func( leaf->entries[i], leaf->entries[j] );
-						dist = dist >= 0.0 ? sqrt(dist) : 0.0;
-						if( min_dists[i] > dist )	min_dists[i] = dist;
-						if( min_dists[j] > dist )	min_dists[j] = dist;
-					}
+					float_type dist = euclidean_intrinsic_double( dim, centroids[i], centroids[j], 1.0, 1.0 );
+					if( min_dists[i] > dist )	{ min_dists[i] = dist; closest[i] = j; }
+					if( min_dists[j] > dist )	{ min_dists[j] = dist; closest[j] = i; }
 				}
-				for( std::size_t i = 0 ; i < leaf->size ; i++ )
-					total_d += min_dists[i];
-				total_n += leaf->size;
 			}
+			return;
+		}
+		for( std::size_t i = 0 ; i < size - 1 ; i++ )
+		{
+			for( std::size_t j = i+1 ; j < size ; j++ )
+			{
+				float_type dist = dist_func( entries[i], entries[j] );
+				if( min_dists[i] > dist )	{ min_dists[i] = dist; closest[i] = j; }
+				if( min_dists[j] > dist )	{ min_dists[j] = dist; closest[j] = i; }
+			}
+		}
+	}
 
-			// next leaf
-			leaf = (CFNodeLeaf*)leaf->next;
+	/** raising the threshold as estimated from the buffered data-points and bulk-loading them.
+	 *
+	 * once in kd-tree order, runs of the buffer hold close data-points as leaves would, so sampled runs give
+	 * the closest-neighbour distances a rebuild of that many leaf entries would predict its threshold from.
+	 */
+	void _end_warm_up()
+	{
+		warm_up_points = 0;
+		cfentry_vec_type entries;
+		entries.swap( warm_up_entries );
+		if( entries.empty() )
+			return;
+
+		_bulk_order( entries );
+		const std::size_t run = max_leaf_entries;
+		std::size_t n_runs = ( entries.size() + run - 1 ) / run;
+		std::size_t stride = (std::max)( entries.size() / threshold_samples, (std::size_t)1 );
+		std::vector<std::size_t> offsets( 1, 0 );
+		for( std::size_t i = 0 ; i < n_runs ; i += stride )
+		{
+			std::size_t size = (std::min)( run, entries.size() - i * run );
+			offsets.push_back( offsets.back() + ( size >= 2 ? size : 0 ) );
 		}
-		return total_d / total_n;
+		std::vector<float_type> dists( offsets.back() );
+		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, offsets.size() - 1, closest_grain_size ), _run_dists_body( *this, entries, run * stride, offsets, dists ) );
+
+		// a buffer short of k_limit stands for the data-points to come: the closest distances of k_limit of them
+		// are expected to shrink as n^(-1/k)
+		std::size_t n_entries = entries.size();
+		if( n_entries < k_limit && !dists.empty() )
+		{
+			float_type scale = std::pow( (float_type)n_entries / k_limit, 1.0 / _closest_dist_shape( dists ) );
+			for( std::size_t i = 0 ; i < dists.size() ; i++ )
+				dists[i] *= scale;
+			n_entries = k_limit;
+		}
+		dist_threshold = _predict_threshold( dists, n_entries );
+		// bulk-loading absorbs otherwise than rebuilds, nothing to learn from
+		predicted_from = 0;
+		_bulk_build( entries );
+		rebuild_pos = 0;
 	}
-public:
-	/** rebuild tree from the existing leaf entries.
+
+	/** closest distances within runs of max_leaf_entries entries, every stride entries, each run writing from its offset in dists */
+	struct _run_dists_body
+	{
+		_run_dists_body( const CFTree& in_tree, const cfentry_vec_type& in_entries, std::size_t in_stride, const std::vector<std::size_t>& in_offsets, std::vector<float_type>& in_dists )
+			: tree(in_tree), entries(in_entries), stride(in_stride), offsets(in_offsets), dists(in_dists) {}
+
+		void operator()( const tbb::blocked_range<std::size_t>& r ) const
+		{
+			for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+			{
+				if( offsets[i+1] > offsets[i] )
+					tree._closest_dists( &entries[i * stride], offsets[i+1] - offsets[i], &dists[offsets[i]] );
+			}
+		}
+
+		const CFTree&					tree;
+		const cfentry_vec_type&			entries;
+		std::size_t						stride;
+		const std::vector<std::size_t>&	offsets;
+		std::vector<float_type>&		dists;
+	};
+
+	/** closest distances within the entries of leaves, in parallel */
+	void _closest_dists( const std::vector<const CFNodeLeaf*>& leaves, std::vector<float_type>& dists ) const
+	{
+		// each leaf writing its dists from its offset in dists
+		std::vector<std::size_t> offsets( leaves.size() + 1, 0 );
+		for( std::size_t i = 0 ; i < leaves.size() ; i++ )
+			offsets[i+1] = offsets[i] + ( leaves[i]->size >= 2 ? leaves[i]->size : 0 );
+		dists.resize( offsets.back() );
+		tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, leaves.size(), closest_grain_size ), _closest_dists_body( *this, leaves, offsets, dists ) );
+	}
+
+	/** every stride-th leaf of the chain into leaves, returning # leaves of the chain.
 	 *
-	 * rebuilding cftree is regarded as clustering, because there could be overlapped cfentries.
-	 * birch guarantees datapoints in cfentries within a range, but two data-points within a range can be separated to different cfentries
+	 * during an incremental rebuild, the leaves of the previous nodes no entry was moved from count too.
+	 */
+	std::size_t _sample_leaves( std::size_t stride, std::vector<const CFNodeLeaf*>& leaves ) const
+	{
+		std::vector<leaf_span> spans;
+		_leaf_spans( spans );
+		std::size_t n_leaves = 0;
+		for( std::size_t i = 0 ; i < spans.size() ; i++ )
+		{
+			if( spans[i].begin == 0 && n_leaves++ % stride == 0 )
+				leaves.push_back( spans[i].leaf );
+		}
+		return n_leaves;
+	}
+
+	struct _closest_dists_body
+	{
+		_closest_dists_body( const CFTree& in_tree, const std::vector<const CFNodeLeaf*>& in_leaves, const std::vector<std::size_t>& in_offsets, std::vector<float_type>& in_dists )
+			: tree(in_tree), leaves(in_leaves), offsets(in_offsets), dists(in_dists) {}
+
+		void operator()( const tbb::blocked_range<std::size_t>& r ) const
+		{
+			for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+			{
+				if( offsets[i+1] > offsets[i] )
+					tree._closest_dists( leaves[i], &dists[offsets[i]] );
+			}
+		}
+
+		const CFTree&							tree;
+		const std::vector<const CFNodeLeaf*>&	leaves;
+		const std::vector<std::size_t>&			offsets;
+		std::vector<float_type>&				dists;
+	};
+
+	/** the sum of the distances of the entries of each leaf to their closest neighbours, and # such entries */
+	struct _closest_sum_body
+	{
+		_closest_sum_body( const CFTree& in_tree, const std::vector<const CFNodeLeaf*>& in_leaves, std::vector<float_type>& in_sums )
+			: tree(in_tree), leaves(in_leaves), sums(in_sums) {}
+
+		void operator()( const tbb::blocked_range<std::size_t>& r ) const
+		{
+			float_type min_dists[max_leaf_entries];
+			std::size_t closest[max_leaf_entries];
+			for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+			{
+				const CFNodeLeaf* leaf = leaves[i];
+				sums[i] = 0.0;
+				if( leaf->size < 2 )
+					continue;
+
+				// the square root taken once per entry, on its closest distance
+				tree._closest_in_leaf( leaf->entries, leaf->size, min_dists, closest );
+				for( std::size_t j = 0 ; j < leaf->size ; j++ )
+					sums[i] += min_dists[j] >= 0.0 ? sqrt( min_dists[j] ) : 0.0;
+			}
+		}
+
+		const CFTree&							tree;
+		const std::vector<const CFNodeLeaf*>&	leaves;
+		std::vector<float_type>&				sums;
+	};
+
+	/** the threshold expected to leave rebuild_fill * k_limit of n_entries leaf entries.
 	 *
-	 * @param extend	if true, the size of tree reaches to memory limit, so distance threshold enlarges.
-	 *					in case of both true and false, rebuilding CFTree from the existing leaves.
+	 * an entry is taken to be absorbed if its closest neighbour is within the threshold, which holds
+	 * for a share of the sampled dists; absorb_ratio of those entries are actually absorbed, the others absorbing them,
+	 * absorb_ratio being learnt from the outcome of the previous predictions. the threshold is then the quantile
+	 * of dists which absorbs the surplus of entries. it never decreases, and grows by 5% at least
+	 * if a rebuild of the same overflow fell short already, as extending rebuilds do.
 	 */
-	void rebuild( bool extend = true )
+	float_type _predict_threshold( std::vector<float_type>& dists, std::size_t n_entries )
 	{
-		if( extend )
+		return _predict_threshold( dists, n_entries, (std::size_t)( rebuild_fill * k_limit ), dist_threshold );
+	}
+
+	/** the threshold expected to leave target of n_entries leaf entries, from floor up, e.g. for dense subtrees */
+	float_type _predict_threshold( std::vector<float_type>& dists, std::size_t n_entries, std::size_t target, float_type floor )
+	{
+		float_type threshold = overflowing && overflow_rebuilds > 1 ? floor * 1.05 : floor;
+		if( dists.empty() || n_entries == 0 )
+			return floor * 1.05;
+
+		target = (std::min)( target, n_entries );
+		float_type share = ( n_entries - target ) / ( absorb_ratio * n_entries );
+		if( share < 1.0 )
+			threshold = (std::max)( threshold, _quantile( dists, share ) );
+		else
 		{
-			// decide the next threshold
-			float_type new_threshold = std::pow(average_dist_closest_pair_leaf_entries() * 0.5, 2);
-			dist_threshold = dist_threshold > new_threshold ? dist_threshold * 1.05 : new_threshold;
+			// more than the closest neighbours can absorb: from the last well-sampled quantile, entries are taken to
+			// fall as threshold^(-k), k fitted to the quartiles of dists as for a Weibull law of closest distances
+			float_type q90 = _quantile( dists, 0.9 );
+			float_type k = _closest_dist_shape( dists );
+			float_type n_left = n_entries * ( 1.0 - absorb_ratio * 0.9 );
+			threshold = (std::max)( threshold, q90 * std::pow( n_left / (std::max)( target, (std::size_t)1 ), 1.0 / k ) );
 		}
 
-		// construct a new tree by inserting all the node from the previous tree
-		CFTree<dim> new_tree( dist_threshold, k_limit, rebuild_interval );
-		
+		std::size_t n_within = 0;
+		for( std::size_t i = 0 ; i < dists.size() ; i++ )
+			n_within += dists[i] < threshold;
+		predicted_fraction = (float_type)n_within / dists.size();
+		predicted_from = n_entries;
+		stats.predicted_entries = n_entries - (std::min)( (std::size_t)( absorb_ratio * predicted_fraction * n_entries ), n_entries );
+		return threshold;
+	}
+
+	/** shape k of a Weibull law fitted to the quartiles of closest distances, from 0.5 to dim */
+	static float_type _closest_dist_shape( std::vector<float_type>& dists )
+	{
+		float_type q25 = _quantile( dists, 0.25 ), q75 = _quantile( dists, 0.75 );
+		float_type k = q25 > 0.0 && q75 > q25 ? 1.5725 / std::log( q75 / q25 ) : 1.0;
+		return (std::min)( (std::max)( k, (float_type)0.5 ), (float_type)dim );
+	}
+
+	/** the share-th quantile of dists, partially sorting them */
+	static float_type _quantile( std::vector<float_type>& dists, float_type share )
+	{
+		typename std::vector<float_type>::iterator q = dists.begin() + (std::min)( (std::size_t)( share * dists.size() ), dists.size() - 1 );
+		std::nth_element( dists.begin(), q, dists.end() );
+		return *q;
+	}
+
+	/** learning absorb_ratio from the # leaf entries the last predicted threshold left */
+	void _calibrate( std::size_t n_entries )
+	{
+		if( predicted_from == 0 )
+			return;
+
+		stats.rebuilt_entries = n_entries;
+		float_type expected = predicted_fraction * predicted_from;
+		if( expected > 0 && n_entries <= predicted_from )
+		{
+			float_type ratio = ( predicted_from - n_entries ) / expected;
+			absorb_ratio = (std::min)( (std::max)( 0.5 * ( absorb_ratio + ratio ), 0.1 ), 4.0 );
+		}
+		predicted_from = 0;
+	}
+
+	/** n more rebuilds of the current overflow of k_limit */
+	void _count_rebuilds( std::size_t n )
+	{
+		if( !overflowing )
+		{
+			overflowing = true;
+			overflow_rebuilds = 0;
+			stats.overflows++;
+		}
+		overflow_rebuilds += n;
+		stats.rebuilds += n;
+		stats.max_rebuilds = (std::max)( stats.max_rebuilds, overflow_rebuilds );
+	}
+
+	/** inserting e into the nodes, without rebuilding */
+	handle_type _insert_entry( CFEntry& e )
+	{
+		bool bsplit;
+		inserted_handle = (handle_type)invalid_handle;
+		entry_added = false;
+		insert(root, e, bsplit);
+		handle_type h = inserted_handle;
+
+		// there's no exception for the root as regard to splitting, indeed
+		if( bsplit )
+		{
+			split_root( e );
+		}
+		return h;
+	}
+
+	/** # leaf entries */
+	std::size_t _leaf_entry_count()
+	{
+		std::size_t n_leaf_entries = 0;
+		for (leaf_iterator it = leaf_begin(); it != leaf_end(); ++it)
+			n_leaf_entries += it->size;
+		return n_leaf_entries;
+	}
+
+	/** handing our handles and checkpoint state over to a tree about to be rebuilt from our leaves */
+	void _prepare_rebuilt( CFTree& new_tree )
+	{
+		// the new tree links handles of merged entries in our handle sets
+		new_tree.handles_tracked = handles_tracked;
+		new_tree.handle_parent.swap( handle_parent );
+		new_tree.dirty_tracked = dirty_tracked;
+		new_tree.handles_checkpointed = handles_checkpointed;
+		new_tree.bulk_rebuilds = bulk_rebuilds;
+		new_tree.rebuild_fill = rebuild_fill;
+		new_tree.absorb_ratio = absorb_ratio;
+		new_tree.overflow_bound = overflow_bound;
+		new_tree.overflow_diameter = overflow_diameter;
+		new_tree.merge_refinement = merge_refinement;
+		new_tree.partial_rebuilds = partial_rebuilds;
+		new_tree._touch( new_tree.root );
+	}
+
+	/** inserting our leaf entries into new_tree, reading nothing else of this tree */
+	void _reinsert_leaves( CFTree& new_tree )
+	{
+		cfentry_vec_type entries;
+		if( bulk_rebuilds )
+			entries.reserve( _leaf_entry_count() );
+
 		CFNodeLeaf* leaf = (CFNodeLeaf*)leaf_dummy;
 		while( leaf != NULL )
 		{
-			for( std::size_t i = 0 ; i < leaf->size ; i++ )
-				new_tree.insert(leaf->entries[i]);
+			if( bulk_rebuilds )
+				entries.insert( entries.end(), leaf->entries, leaf->entries + leaf->size );
+			else
+				for( std::size_t i = 0 ; i < leaf->size ; i++ )
+					new_tree.insert(leaf->entries[i]);
 
 			// next leaf
 			leaf = (CFNodeLeaf*)leaf->next;
 		}
 
+		if( bulk_rebuilds )
+			new_tree._bulk_load( entries );
+	}
+
+	/** inserting our leaf entries into new_tree, deleting our nodes as soon as they are used up.
+	 *
+	 * split nodes left out of the tree go first, then every leaf once its entries are reinserted,
+	 * and every intermediate node with its last child, so both trees together never hold much more than this one.
+	 */
+	void _consume_leaves( CFTree& new_tree )
+	{
+		// parents and # remaining children of the nodes in the tree
+		boost::unordered_map<CFNode*, CFNode*> parents;
+		boost::unordered_map<CFNode*, std::size_t> remaining;
+		std::vector<CFNode*> order( 1, root );
+		for( std::size_t i = 0 ; i < order.size() ; i++ )
+		{
+			CFNode* node = order[i];
+			if( node->IsLeaf() )
+				continue;
+			remaining[node] = node->size;
+			for( std::size_t j = 0 ; j < node->size ; j++ )
+			{
+				parents[node->entries[j].child] = node;
+				order.push_back( node->entries[j].child );
+			}
+		}
+		std::vector<CFNode*>().swap( order );
+
+		// every node but the root is listed in nodes, the unparented ones are out of the tree
+		for( std::size_t i = 0 ; i < nodes->size() ; i++ )
+			if( parents.find( nodes->at(i) ) == parents.end() )
+				delete nodes->at(i);
+		delete nodes;
+		nodes = NULL;
+
+		// a bulk load takes the entries all at once, gathered as compactly as the leaves they come from
+		cfentry_vec_type entries;
+		if( bulk_rebuilds )
+			entries.reserve( _leaf_entry_count() );
+
+		CFNodeLeaf* leaf = (CFNodeLeaf*)((CFNodeLeaf*)leaf_dummy)->next;
+		delete leaf_dummy;
+		leaf_dummy = NULL;
+
+		while( leaf != NULL )
+		{
+			if( bulk_rebuilds )
+				entries.insert( entries.end(), leaf->entries, leaf->entries + leaf->size );
+			else
+				for( std::size_t i = 0 ; i < leaf->size ; i++ )
+					new_tree.insert(leaf->entries[i]);
+
+			// next leaf
+			CFNodeLeaf* next = (CFNodeLeaf*)leaf->next;
+
+			// the leaf, and the ancestors it was the last child of
+			CFNode* node = leaf;
+			for( ;; )
+			{
+				typename boost::unordered_map<CFNode*, CFNode*>::iterator it = parents.find( node );
+				CFNode* parent = it != parents.end() ? it->second : NULL;
+				delete node;
+				if( parent == NULL || --remaining[parent] > 0 )
+					break;
+				node = parent;
+			}
+
+			leaf = next;
+		}
+
+		// the root went with its last leaf
+		root = NULL;
+		node_cnt = 0;
+
+		if( bulk_rebuilds )
+			new_tree._bulk_load( entries );
+	}
+
+	/** rebuilding the densest subtrees alone, see rebuild_partially().
+	 *
+	 * subtrees are the children of the first level below the root with min_partial_subtrees nodes, not going down
+	 * to the leaves. the ones with more leaf entries than the average are picked, densest first, until they hold
+	 * twice the surplus over rebuild_target() * k_limit, and a threshold predicted from their leaves has them shed it.
+	 * @return false, rebuilding nothing, if the dense subtrees hold too few entries, if every subtree is dense,
+	 *	or if one of them comes out taller than it was
+	 */
+	bool _rebuild_dense()
+	{
+		if( root->IsLeaf() || root->entries[0].child->IsLeaf() )
+			return false;
+		_invalidate_leaf_map();
+
+		// subtrees by the entries pointing to them, and the nodes holding these
+		std::vector<CFEntry*> subtrees;
+		std::vector<CFNode*> owners;
+		for( std::size_t i = 0 ; i < root->size ; i++ )
+		{
+			subtrees.push_back( &root->entries[i] );
+			owners.push_back( root );
+		}
+		while( subtrees.size() < min_partial_subtrees )
+		{
+			std::vector<CFEntry*> below;
+			std::vector<CFNode*> below_owners;
+			for( std::size_t i = 0 ; i < subtrees.size() ; i++ )
+			{
+				CFNode* child = subtrees[i]->child;
+				if( child->entries[0].child->IsLeaf() )
+				{
+					below.push_back( subtrees[i] );
+					below_owners.push_back( owners[i] );
+					continue;
+				}
+				for( std::size_t j = 0 ; j < child->size ; j++ )
+				{
+					below.push_back( &child->entries[j] );
+					below_owners.push_back( child );
+				}
+			}
+			if( below.size() == subtrees.size() )
+				break;
+			subtrees.swap( below );
+			owners.swap( below_owners );
+		}
+
+		// leaf entries of every subtree
+		std::vector< std::vector<CFNode*> > members( subtrees.size() );
+		std::vector<std::size_t> counts( subtrees.size(), 0 );
+		std::size_t n_entries = 0;
+		for( std::size_t i = 0 ; i < subtrees.size() ; i++ )
+		{
+			_subtree_nodes( subtrees[i]->child, members[i] );
+			for( std::size_t j = 0 ; j < members[i].size() ; j++ )
+				counts[i] += members[i][j]->IsLeaf() ? members[i][j]->size : 0;
+			n_entries += counts[i];
+		}
+
+		// the densest ones above the average
+		std::size_t surplus = n_entries - (std::min)( (std::size_t)( rebuild_fill * k_limit ), n_entries );
+		std::vector< std::pair<std::size_t, std::size_t> > order( subtrees.size() );
+		for( std::size_t i = 0 ; i < subtrees.size() ; i++ )
+			order[i] = std::make_pair( counts[i], i );
+		std::sort( order.begin(), order.end(), std::greater< std::pair<std::size_t, std::size_t> >() );
+		std::vector<std::size_t> dense;
+		std::size_t n_dense = 0;
+		for( std::size_t k = 0 ; k < order.size() && n_dense < 2 * surplus ; k++ )
+		{
+			if( order[k].first * subtrees.size() <= n_entries )
+				break;
+			dense.push_back( order[k].second );
+			n_dense += order[k].first;
+		}
+		if( surplus == 0 || n_dense < 2 * surplus || dense.size() == subtrees.size() )
+			return false;
+
+		// one threshold for them, from their sampled leaves and never under the ones they have
+		std::vector<const CFNodeLeaf*> leaves;
+		const std::size_t stride = (std::max)( n_dense / threshold_samples, (std::size_t)1 );
+		std::size_t n_leaves = 0;
+		float_type floor = dist_threshold;
+		for( std::size_t k = 0 ; k < dense.size() ; k++ )
+		{
+			const std::vector<CFNode*>& nodes_k = members[dense[k]];
+			for( std::size_t j = 0 ; j < nodes_k.size() ; j++ )
+			{
+				floor = (std::max)( floor, nodes_k[j]->threshold );
+				if( nodes_k[j]->IsLeaf() && n_leaves++ % stride == 0 )
+					leaves.push_back( (const CFNodeLeaf*)nodes_k[j] );
+			}
+		}
+		std::vector<float_type> dists;
+		_closest_dists( leaves, dists );
+		float_type threshold = _predict_threshold( dists, n_dense, n_dense - surplus, floor );
+
+		// all of them rebuilt before any is replaced, as a taller one would put its leaves below the others
+		std::vector<handle_type> saved_handles( handle_parent );
+		std::vector<CFTree*> subs;
+		bool taller = false;
+		for( std::size_t k = 0 ; k < dense.size() && !taller ; k++ )
+		{
+			subs.push_back( new CFTree( threshold, 0, rebuild_interval, dist_func, absorb_dist_func ) );
+			_rebuild_members( members[dense[k]], threshold, *subs[k] );
+			taller = _height( subs[k]->root ) > _height( subtrees[dense[k]]->child );
+		}
+		std::size_t n_rebuilt = 0;
+		if( taller )
+			handle_parent.swap( saved_handles );
+		else
+			for( std::size_t k = 0 ; k < dense.size() ; k++ )
+				n_rebuilt += _graft_subtree( *subtrees[dense[k]], owners[dense[k]], members[dense[k]], *subs[k], threshold );
+		for( std::size_t k = 0 ; k < subs.size() ; k++ )
+			delete subs[k];
+		if( taller )
+			return false;
+		_calibrate( n_rebuilt );
+		stats.partial_rebuilds++;
+		return true;
+	}
+
+	/** node and every node below it */
+	static void _subtree_nodes( CFNode* node, std::vector<CFNode*>& out )
+	{
+		std::size_t first = out.size();
+		out.push_back( node );
+		for( std::size_t i = first ; i < out.size() ; i++ )
+			if( !out[i]->IsLeaf() )
+				for( std::size_t j = 0 ; j < out[i]->size ; j++ )
+					out.push_back( out[i]->entries[j].child );
+	}
+
+	/** levels from node down to its leaves, 1 for a leaf */
+	static std::size_t _height( const CFNode* node )
+	{
+		std::size_t height = 1;
+		for( ; !node->IsLeaf() ; node = node->entries[0].child )
+			height++;
+		return height;
+	}
+
+	/** building sub under threshold from the leaf entries of members, which are left as they are.
+	 *
+	 * sub links handles in our handle sets while it is built, they are ours again once it is.
+	 */
+	void _rebuild_members( const std::vector<CFNode*>& members, float_type threshold, CFTree& sub )
+	{
+		cfentry_vec_type entries;
+		for( std::size_t i = 0 ; i < members.size() ; i++ )
+			if( members[i]->IsLeaf() )
+				entries.insert( entries.end(), members[i]->entries, members[i]->entries + members[i]->size );
+
+		_prepare_rebuilt( sub );
+		if( bulk_rebuilds )
+			sub._bulk_load( entries );
+		else
+			for( std::size_t i = 0 ; i < entries.size() ; i++ )
+				sub.insert( entries[i] );
+		handle_parent.swap( sub.handle_parent );
+	}
+
+	/** replacing the subtree of entry, in owner, by sub, rebuilt from its members under threshold and no taller than it.
+	 *
+	 * the new nodes take ids of this tree, and single-entry nodes on top of them keep the leaves at the same depth.
+	 * @return # leaf entries of the new subtree
+	 */
+	std::size_t _graft_subtree( CFEntry& entry, CFNode* owner, const std::vector<CFNode*>& members, CFTree& sub, float_type threshold )
+	{
+		const std::size_t height = _height( entry.child );
+		_free_nodes( members );
+		dirty_handles.insert( dirty_handles.end(), sub.dirty_handles.begin(), sub.dirty_handles.end() );
+		stats.leaf_merges += sub.stats.leaf_merges;
+		refinement_merges += sub.refinement_merges;
+		refinement_resplits += sub.refinement_resplits;
+
+		// its nodes become ours, the ones out of its tree going with it
+		std::vector<CFNode*> grafted;
+		_subtree_nodes( sub.root, grafted );
+		boost::unordered_set<CFNode*> kept( grafted.begin(), grafted.end() );
+		std::size_t n_left = 0;
+		for( std::size_t i = 0 ; i < sub.nodes->size() ; i++ )
+			if( kept.find( sub.nodes->at(i) ) == kept.end() )
+				sub.nodes->at(n_left++) = sub.nodes->at(i);
+		sub.nodes->resize( n_left );
+
+		std::size_t n_rebuilt = 0;
+		for( std::size_t i = 0 ; i < grafted.size() ; i++ )
+		{
+			CFNode* node = grafted[i];
+			node->id = next_node_id++;
+			node->threshold = threshold;
+			node->dirty = false;
+			_touch( node );
+			_add_node( node );
+			n_rebuilt += node->IsLeaf() ? node->size : 0;
+		}
+		std::size_t sub_height = _height( sub.root );
+		node_cnt += grafted.size();
+
+		CFNode* top = sub.root;
+		sub.root = NULL;
+		for( ; sub_height < height ; sub_height++ )
+		{
+			CFNode* pad = _new_node( false );
+			pad->threshold = threshold;
+			CFEntry e( top );
+			for( std::size_t i = 0 ; i < top->size ; i++ )
+				e += top->entries[i];
+			pad->Add( e );
+			_add_node( pad );
+			node_cnt++;
+			top = pad;
+		}
+		entry.child = top;
+		_touch( owner );
+
+		// its leaves go in front of ours
+		CFNodeLeaf* first = (CFNodeLeaf*)((CFNodeLeaf*)sub.leaf_dummy)->next;
+		CFNodeLeaf* last = first;
+		while( last->next != NULL )
+			last = (CFNodeLeaf*)last->next;
+		CFNodeLeaf* head = (CFNodeLeaf*)((CFNodeLeaf*)leaf_dummy)->next;
+		last->next = head;
+		if( head != NULL )
+		{
+			head->prev = last;
+			_touch( head );
+		}
+		first->prev = leaf_dummy;
+		((CFNodeLeaf*)leaf_dummy)->next = first;
+		((CFNodeLeaf*)sub.leaf_dummy)->next = NULL;
+
+		return n_rebuilt;
+	}
+
+	/** replacing our nodes by the ones of a rebuilt tree */
+	void _adopt( CFTree& new_tree )
+	{
 		// really I'd like to replace the previous tree to the new one by
 		// stating " *this = new_tree; ", but it doesn't work because 'this' is const pointer
 		// copy root and dummy_node
@@ -817,6 +2271,24 @@ public:
 		leaf_dummy = new_tree.leaf_dummy;
 		nodes = new_tree.nodes;
 		node_cnt = new_tree.node_cnt;
+		dist_threshold = new_tree.dist_threshold;
+
+		// the new tree may have overflowed k_limit itself while taking our entries
+		absorb_ratio = new_tree.absorb_ratio;
+		if( new_tree.stats.rebuilds > 0 )
+			_count_rebuilds( new_tree.stats.rebuilds );
+		stats.leaf_merges += new_tree.stats.leaf_merges;
+		stats.partial_rebuilds += new_tree.stats.partial_rebuilds;
+		refinement_merges += new_tree.refinement_merges;
+		refinement_resplits += new_tree.refinement_resplits;
+
+		handle_parent.swap( new_tree.handle_parent );
+
+		// every node of the new tree is dirty, their ids only have to be unique from now on
+		next_node_id = new_tree.next_node_id;
+		dirty_nodes.swap( new_tree.dirty_nodes );
+		freed_dirty_nodes.swap( new_tree.freed_dirty_nodes );
+		dirty_handles.insert( dirty_handles.end(), new_tree.dirty_handles.begin(), new_tree.dirty_handles.end() );
 
 		new_tree.root = NULL;
 		new_tree.leaf_dummy = NULL;
@@ -826,6 +2298,274 @@ public:
 		scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, NULL);
 	}
 
+	/** a rebuild under way in the background */
+	struct _background_rebuild
+	{
+		_background_rebuild() : rebuilt(NULL), side(NULL), old(NULL), handle_base(0), done(false) {}
+		~_background_rebuild()
+		{
+			group.wait();
+			delete rebuilt;
+			delete side;
+			delete old;
+		}
+
+		tbb::task_group		group;
+		CFTree*				rebuilt;		/* tree built from the frozen leaves */
+		CFTree*				side;			/* tree taking the insertions meanwhile */
+		CFTree*				old;			/* the frozen nodes once replaced, deleted in the background */
+		handle_type			handle_base;	/* # handles of the rebuilt tree, the side tree's follow */
+		std::atomic<bool>	done;
+	};
+
+	struct _rebuild_task
+	{
+		_rebuild_task( CFTree& in_tree, _background_rebuild& in_bg ) : tree(in_tree), bg(in_bg) {}
+
+		void operator()() const
+		{
+			// the frozen nodes are all the task reads of tree, the prediction came with the rebuilt tree
+			CFTree& rebuilt = *bg.rebuilt;
+			tree._reinsert_leaves( rebuilt );
+			rebuilt._calibrate( rebuilt._leaf_entry_count() );
+			while( rebuilt.k_limit > 0 && rebuilt._leaf_entry_count() > rebuilt.k_limit )
+			{
+				rebuilt.rebuild();
+				rebuilt._count_rebuilds( 1 );
+			}
+			bg.done = true;
+		}
+
+		CFTree&					tree;
+		_background_rebuild&	bg;
+	};
+
+	struct _retire_task
+	{
+		_retire_task( _background_rebuild& in_bg ) : bg(in_bg) {}
+
+		void operator()() const
+		{
+			delete bg.old;
+			bg.old = NULL;
+		}
+
+		_background_rebuild&	bg;
+	};
+
+	/** a rebuild spread over insertions, see rebuild_incrementally() */
+	struct _migration
+	{
+		_migration() : old(NULL), leaf(NULL), pos(0), phase(measuring), n_entries(0), n_leaves(0), n_kept(0) {}
+
+		enum phase_type { measuring, moving, deleting };
+
+		CFTree*			old;		/* the previous nodes */
+		CFNodeLeaf*		leaf;		/* next leaf of old to measure or move */
+		std::size_t		pos;		/* next entry of leaf to move */
+		phase_type		phase;
+		std::vector<float_type>	dists;	/* closest neighbour distances sampled so far */
+		std::size_t		n_entries;	/* # leaf entries of old */
+		std::size_t		n_leaves;	/* # leaves of old measured so far */
+		std::size_t		n_kept;		/* # leaf entries of the tree, moved or inserted, merged into none */
+	};
+
+	/** moving the nodes, holding n_entries leaf entries, to a migration, the tree starting over empty at the same threshold */
+	void _start_migration( std::size_t n_entries )
+	{
+		_migration* mg = new _migration();
+		mg->old = new CFTree( dist_threshold, 0, rebuild_interval, dist_func, absorb_dist_func );
+		mg->old->clear();
+		mg->n_entries = n_entries;
+		std::swap( mg->old->root, root );
+		std::swap( mg->old->leaf_dummy, leaf_dummy );
+		std::swap( mg->old->nodes, nodes );
+		std::swap( mg->old->node_cnt, node_cnt );
+		mg->leaf = (CFNodeLeaf*)((CFNodeLeaf*)mg->old->leaf_dummy)->next;
+
+		// the previous nodes won't be part of the tree anymore
+		_clear_dirty_nodes();
+
+		root = _new_node( true );
+		leaf_dummy = new CFNodeLeaf();
+		((CFNodeLeaf*)leaf_dummy)->next = root;
+		nodes = new cfnode_ptr_vec_type();
+		node_cnt = 1;
+
+		migration = mg;
+	}
+
+	/** at most budget steps of the migration, a step being one leaf entry to measure, move or one node to delete */
+	void _migrate( std::size_t budget )
+	{
+		_migration& mg = *migration;
+		while( budget > 0 )
+		{
+			if( mg.phase == _migration::measuring )
+			{
+				if( mg.leaf == NULL )
+				{
+					dist_threshold = _predict_threshold( mg.dists, mg.n_entries );
+					mg.leaf = (CFNodeLeaf*)((CFNodeLeaf*)mg.old->leaf_dummy)->next;
+					mg.phase = _migration::moving;
+					continue;
+				}
+				// the leaves _next_threshold() would sample
+				if( mg.n_leaves++ % (std::max)( mg.n_entries / threshold_samples, (std::size_t)1 ) == 0 )
+				{
+					_add_closest_dists( mg.leaf, mg.dists );
+					budget -= (std::min)( budget, (std::max)( mg.leaf->size, (std::size_t)1 ) );
+				}
+				else
+					budget--;
+				mg.leaf = (CFNodeLeaf*)mg.leaf->next;
+			}
+			else if( mg.phase == _migration::moving )
+			{
+				if( mg.leaf == NULL )
+				{
+					_calibrate( mg.n_kept );
+					mg.phase = _migration::deleting;
+					continue;
+				}
+				if( mg.pos < mg.leaf->size )
+				{
+					_insert_entry( mg.leaf->entries[mg.pos++] );
+					mg.n_kept += entry_added ? 1 : 0;
+					budget--;
+					continue;
+				}
+				mg.leaf = (CFNodeLeaf*)mg.leaf->next;
+				mg.pos = 0;
+			}
+			else
+			{
+				cfnode_ptr_vec_type& old_nodes = *mg.old->nodes;
+				if( !old_nodes.empty() )
+				{
+					delete old_nodes.back();
+					old_nodes.pop_back();
+					budget--;
+					continue;
+				}
+
+				// only the root and the leaf dummy are left
+				delete mg.old;
+				delete migration;
+				migration = NULL;
+				return;
+			}
+		}
+	}
+
+	/** ending the warm-up and waiting for a background rebuild, if any, leaving an incremental one under way */
+	void _finish_background()
+	{
+		if( !warm_up_entries.empty() )
+			_end_warm_up();
+
+		if( background == NULL )
+			return;
+
+		background->group.wait();
+		_background_rebuild* bg = background;
+		background = NULL;
+
+		// the previous nodes are deleted by the background task too
+		bg->old = new CFTree( dist_threshold, 0, rebuild_interval, dist_func, absorb_dist_func );
+		bg->old->clear();
+		std::swap( bg->old->root, root );
+		std::swap( bg->old->leaf_dummy, leaf_dummy );
+		std::swap( bg->old->nodes, nodes );
+		_adopt( *bg->rebuilt );
+		stats.predicted_entries = bg->rebuilt->stats.predicted_entries;
+		stats.rebuilt_entries = bg->rebuilt->stats.rebuilt_entries;
+		bg->group.run( _retire_task( *bg ) );
+		retired = bg;
+
+		// replaying the side tree, its handles following the ones of the rebuilt tree
+		bool enabled = background_rebuilds;
+		background_rebuilds = false;
+		merge( *bg->side, false );
+		background_rebuilds = enabled;
+	}
+
+	/** entries [begin, leaf->size) of a leaf */
+	struct leaf_span
+	{
+		leaf_span( const CFNodeLeaf* in_leaf, std::size_t in_begin ) : leaf(in_leaf), begin(in_begin) {}
+
+		const CFNodeLeaf*	leaf;
+		std::size_t			begin;
+	};
+
+	/** the leaf entries of the tree, in the order of get_entries().
+	 *
+	 * during an incremental rebuild, the entries of the previous nodes not moved yet follow the leaves of the tree,
+	 * so that reads don't have to complete it.
+	 */
+	void _leaf_spans( std::vector<leaf_span>& spans ) const
+	{
+		spans.clear();
+		for( const CFNodeLeaf* leaf = (const CFNodeLeaf*)((const CFNodeLeaf*)leaf_dummy)->next ; leaf != NULL ; leaf = (const CFNodeLeaf*)leaf->next )
+			spans.push_back( leaf_span( leaf, 0 ) );
+
+		if( migration == NULL || migration->phase == _migration::deleting )
+			return;
+		const CFNodeLeaf* leaf = (const CFNodeLeaf*)((const CFNodeLeaf*)migration->old->leaf_dummy)->next;
+		std::size_t begin = 0;
+		if( migration->phase == _migration::moving )
+		{
+			leaf = migration->leaf;
+			begin = migration->pos;
+		}
+		for( ; leaf != NULL ; leaf = (const CFNodeLeaf*)leaf->next, begin = 0 )
+			if( begin < leaf->size )
+				spans.push_back( leaf_span( leaf, begin ) );
+	}
+
+	/** root of the previous nodes while an incremental rebuild still reads them, NULL otherwise */
+	const CFNode* _migrating_root() const
+	{
+		return migration && migration->phase != _migration::deleting ? migration->old->root : NULL;
+	}
+
+	/** leaving the tree, frozen, to a background rebuild */
+	void _start_rebuild()
+	{
+		delete retired;
+		retired = NULL;
+
+		// leaf entries get their handles now, so that the rebuilt tree gives no new ones
+		if( handles_tracked )
+			for( leaf_iterator it = leaf_begin() ; it != leaf_end() ; ++it )
+				for( std::size_t i = 0 ; i < it->size ; i++ )
+					if( it->entries[i].handle == (handle_type)invalid_handle )
+					{
+						it->entries[i].handle = handle_parent.size();
+						handle_parent.push_back( it->entries[i].handle );
+					}
+
+		_background_rebuild* bg = new _background_rebuild();
+		bg->rebuilt = new CFTree( dist_threshold, k_limit, rebuild_interval, dist_func, absorb_dist_func );
+		_prepare_rebuilt( *bg->rebuilt );
+
+		// predicted here, so that the task writes nothing but the rebuilt tree, which calibrates itself from it
+		CFTree& rebuilt = *bg->rebuilt;
+		rebuilt.dist_threshold = _next_threshold();
+		rebuilt.predicted_fraction = predicted_fraction;
+		rebuilt.predicted_from = predicted_from;
+		rebuilt.stats.predicted_entries = stats.predicted_entries;
+		rebuilt.stats.rebuilt_entries = stats.rebuilt_entries;
+		predicted_from = 0;
+		bg->handle_base = bg->rebuilt->handle_parent.size();
+		bg->side = new CFTree( dist_threshold, 0, rebuild_interval, dist_func, absorb_dist_func );
+		bg->side->handles_tracked = handles_tracked;
+
+		background = bg;
+		bg->group.run( _rebuild_task( *this, *bg ) );
+	}
+
 private:
 
 	// data structure
@@ -844,11 +2584,70 @@ private:
 	// statistics
 	std::size_t			node_cnt;
 
+	// subcluster handles
+	bool						handles_tracked;
+	handle_type					inserted_handle;	/* handle of the last insertion */
+	bool						entry_added;		/* the last insertion added a leaf entry rather than merging into one */
+	std::vector<handle_type>	handle_parent;		/* union-find forest of handles, merged handles point to the absorbing one */
+
+	// checkpoints
+	std::size_t					next_node_id;		/* persistent id of the next new node */
+	bool						dirty_tracked;		/* whether changed nodes are listed for checkpoints */
+	std::vector<CFNode*>		dirty_nodes;		/* nodes changed since the last checkpoint, retired ones are no longer dirty */
+	std::vector<CFNode*>		freed_dirty_nodes;	/* nodes freed while listed in dirty_nodes, deleted once it is cleared */
+	std::vector<handle_type>	dirty_handles;		/* checkpointed handles merged since the last checkpoint */
+	std::size_t					handles_checkpointed;	/* # handles as of the last checkpoint */
+
+	// background rebuilds
+	bool						background_rebuilds;
+	_background_rebuild*		background;			/* rebuild under way, NULL if none */
+	_background_rebuild*		retired;			/* last rebuild, deleting the nodes it replaced */
+	std::size_t					migration_budget;	/* steps of an incremental rebuild per insertion, 0 for none */
+	_migration*					migration;			/* incremental rebuild under way, NULL if none */
+	bool						bulk_rebuilds;		/* whether rebuilds bulk-load the leaf entries */
+
+	// rebuild thresholds
+	float_type					rebuild_fill;		/* # leaf entries rebuilds aim at, as a fraction of k_limit */
+	float_type					absorb_ratio;		/* share of the entries within the threshold of their neighbours which rebuilds absorb */
+	std::size_t					predicted_from;		/* # leaf entries when the last threshold was predicted, 0 once learnt from */
+	float_type					predicted_fraction;	/* share of them sampled within that threshold of their neighbours */
+	bool						overflowing;		/* whether the leaf entries are over k_limit, rebuilds not being over */
+	std::size_t					overflow_rebuilds;	/* # rebuilds of the current overflow */
+	rebuild_stats				stats;
+
+	// warm-up
+	std::size_t					warm_up_points;		/* # data-points to buffer before the first insertion, 0 if not warming up */
+	cfentry_vec_type			warm_up_entries;	/* data-points buffered so far */
+
+	// merging on overflow
+	float_type					overflow_bound;		/* bound of merged entries over the threshold, 0 not to merge */
+	bool						overflow_diameter;	/* whether the bound applies to the diameter rather than the radius */
+
+	// merging refinement
+	bool						merge_refinement;	/* whether splits are followed by the merging refinement */
+	std::size_t					refinement_merges;	/* # pairs of nodes it merged */
+	std::size_t					refinement_resplits;	/* # pairs of nodes it split again */
+
+	// partial rebuilds
+	bool						partial_rebuilds;	/* whether overflows of k_limit rebuild the dense subtrees alone if they can */
+
 /* phase 3 - applying a global clustering algorithm to subclusters */
 #include "CFTree_CFCluster.h"
 
 /* phase 4 - redistribute actual data points to subclusters */
 #include "CFTree_Redist.h"
+
+/* phase 4 - refining phase 3 clusters by k-means */
+#include "CFTree_KMeans.h"
+
+/* persistence - snapshots of a built tree */
+#include "CFTree_Snapshot.h"
+
+/* distribution - merging trees built on separate shards */
+#include "CFTree_Merge.h"
+
+/* rebuilding - bulk-loading a tree from its leaf entries */
+#include "CFTree_BulkLoad.h"
 };
 
 #endif
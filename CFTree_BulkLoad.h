@@ -0,0 +1,328 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+#ifndef __CFTREE_BULKLOAD_H__
+#define __CFTREE_BULKLOAD_H__
+
+/************************************************************************/
+/* a partial class of CFTree, rebuilding a tree at once from its leaf entries
+/************************************************************************/
+
+// class CFTree
+// {
+
+	private:
+		enum { bulk_sample_size = 64 /* # centroids choosing a splitting axis */, bulk_grain_size = 4096 /* # entries partitioned on one thread */ };
+
+		/** building the nodes of this empty tree from entries at once.
+		 *
+		 * entries are ordered along a kd-tree of their centroids, split at medians of the widest axis down to cells
+		 * of as many entries as two leaves hold; only compact copies of the centroids move while partitioning.
+		 * within a cell, every entry is absorbed by the closest one kept so far under dist_threshold,
+		 * as an insertion would do within a leaf. the entries left are packed in that order into full leaves,
+		 * the leaves into full intermediate nodes, and so on up to the root.
+		 * every step but the final linking runs in parallel, and entries is used up.
+		 */
+		void _bulk_load( cfentry_vec_type& entries )
+		{
+			if( entries.empty() )
+				return;
+
+			_bulk_order( entries );
+			_bulk_build( entries );
+		}
+
+		/** # entries of a cell of the kd-tree ordering */
+		std::size_t _bulk_cell_size() const { return 2 * root->MaxEntrySize(); }
+
+		/** ordering entries along a kd-tree of their centroids, whose cells of _bulk_cell_size() entries hold close ones */
+		void _bulk_order( cfentry_vec_type& entries ) const
+		{
+			std::vector<_bulk_point> points( entries.size() );
+			tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, entries.size(), 1024 ), _bulk_point_body( entries, points ) );
+			_bulk_partition_body( &points[0], &points[0] + points.size(), _bulk_cell_size() )();
+			_bulk_permute( entries, points );
+		}
+
+		/** building the nodes of this empty tree from entries in kd-tree order, see _bulk_load() */
+		void _bulk_build( cfentry_vec_type& entries )
+		{
+			// absorbed handles only point to kept ones, so all of them must exist beforehand
+			for( std::size_t i = 0 ; i < entries.size() ; i++ )
+				_assign_handle( entries[i] );
+			inserted_handle = (handle_type)invalid_handle;
+
+			const std::size_t max_entries = root->MaxEntrySize();
+			const std::size_t cell_size = _bulk_cell_size();
+			std::size_t n_cells = ( entries.size() + cell_size - 1 ) / cell_size;
+			std::vector<std::size_t> kept( n_cells );
+			tbb::combinable< std::vector<handle_type> > merged;
+			tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_cells ), _bulk_absorb_body( *this, entries, cell_size, kept, merged ) );
+
+			if( dirty_tracked )
+				merged.combine_each( _append_handles( dirty_handles ) );
+
+			// the entries kept by every cell, back to back
+			std::size_t n_entries = kept[0];
+			for( std::size_t c = 1 ; c < n_cells ; c++ )
+			{
+				typename cfentry_vec_type::iterator cell = entries.begin() + c * cell_size;
+				std::copy( cell, cell + kept[c], entries.begin() + n_entries );
+				n_entries += kept[c];
+			}
+			entries.resize( n_entries );
+
+			// the empty root is replaced by the top of the packed levels
+			dirty_nodes.erase( std::remove( dirty_nodes.begin(), dirty_nodes.end(), root ), dirty_nodes.end() );
+			delete root;
+			root = NULL;
+			node_cnt = 0;
+
+			bool leaf = true;
+			for( ;; )
+			{
+				std::size_t n_nodes = ( entries.size() + max_entries - 1 ) / max_entries;
+				std::vector<CFNode*> level( n_nodes );
+				cfentry_vec_type parents( n_nodes );
+				tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_nodes ), _bulk_pack_body( entries, level, parents, leaf ) );
+
+				for( std::size_t i = 0 ; i < n_nodes ; i++ )
+				{
+					level[i]->id = next_node_id++;
+					_touch( level[i] );
+				}
+				node_cnt += n_nodes;
+
+				if( leaf )
+				{
+					CFNode* prev = n_nodes > 1 ? leaf_dummy : NULL;
+					((CFNodeLeaf*)leaf_dummy)->next = level[0];
+					for( std::size_t i = 0 ; i < n_nodes ; i++ )
+					{
+						((CFNodeLeaf*)level[i])->prev = prev;
+						((CFNodeLeaf*)level[i])->next = i + 1 < n_nodes ? level[i + 1] : NULL;
+						prev = level[i];
+					}
+				}
+
+				if( n_nodes == 1 )
+				{
+					root = level[0];
+					break;
+				}
+
+				for( std::size_t i = 0 ; i < n_nodes ; i++ )
+					_add_node( level[i] );
+				entries.swap( parents );
+				leaf = false;
+			}
+			cfentry_vec_type().swap( entries );
+		}
+
+		/** centroid of the entry at index, in single precision, moved around in place of the entry */
+		struct _bulk_point
+		{
+			float			centroid[dim];
+			std::size_t		index;
+		};
+
+		struct _bulk_point_body
+		{
+			_bulk_point_body( const cfentry_vec_type& in_entries, std::vector<_bulk_point>& in_points ) : entries(in_entries), points(in_points) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
+			{
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+				{
+					const CFEntry& e = entries[i];
+					for( std::size_t j = 0 ; j < dim ; j++ )
+						points[i].centroid[j] = (float)( e.sum[j] / e.n );
+					points[i].index = i;
+				}
+			}
+
+			const cfentry_vec_type&		entries;
+			std::vector<_bulk_point>&	points;
+		};
+
+		/** orders points by their centroid coordinate along one axis */
+		struct _centroid_less
+		{
+			_centroid_less( std::size_t in_axis ) : axis(in_axis) {}
+			bool operator()( const _bulk_point& lhs, const _bulk_point& rhs ) const { return lhs.centroid[axis] < rhs.centroid[axis]; }
+
+			std::size_t axis;
+		};
+
+		/** putting entries in the order of points, following the cycles of the permutation */
+		static void _bulk_permute( cfentry_vec_type& entries, std::vector<_bulk_point>& points )
+		{
+			for( std::size_t i = 0 ; i < points.size() ; i++ )
+			{
+				if( points[i].index == i )
+					continue;
+
+				CFEntry first = entries[i];
+				std::size_t j = i;
+				while( points[j].index != i )
+				{
+					std::size_t k = points[j].index;
+					entries[j] = entries[k];
+					points[j].index = j;
+					j = k;
+				}
+				entries[j] = first;
+				points[j].index = j;
+			}
+		}
+
+		/** kd-tree ordering of [begin, end), whose cells of cell_size entries start at multiples of cell_size from begin */
+		struct _bulk_partition_body
+		{
+			_bulk_partition_body( _bulk_point* in_begin, _bulk_point* in_end, std::size_t in_cell_size ) : begin(in_begin), end(in_end), cell_size(in_cell_size) {}
+
+			void operator()() const
+			{
+				std::size_t n = end - begin;
+				if( n <= cell_size )
+					return;
+
+				// the axis along which the centroids spread the most, judged on a sample of them
+				std::vector<float> lo( dim, (std::numeric_limits<float>::max)() ), hi( dim, -(std::numeric_limits<float>::max)() );
+				std::size_t step = (std::max)( n / bulk_sample_size, (std::size_t)1 );
+				for( const _bulk_point* p = begin ; p < end ; p += step )
+				{
+					for( std::size_t i = 0 ; i < dim ; i++ )
+					{
+						if( lo[i] > p->centroid[i] )	lo[i] = p->centroid[i];
+						if( hi[i] < p->centroid[i] )	hi[i] = p->centroid[i];
+					}
+				}
+				std::size_t axis = 0;
+				for( std::size_t i = 1 ; i < dim ; i++ )
+					if( hi[i] - lo[i] > hi[axis] - lo[axis] )
+						axis = i;
+
+				// halves made of whole cells
+				_bulk_point* mid = begin + ( ( n + cell_size - 1 ) / cell_size / 2 ) * cell_size;
+				std::nth_element( begin, mid, end, _centroid_less( axis ) );
+
+				if( n > bulk_grain_size )
+					tbb::parallel_invoke( _bulk_partition_body( begin, mid, cell_size ), _bulk_partition_body( mid, end, cell_size ) );
+				else
+				{
+					_bulk_partition_body( begin, mid, cell_size )();
+					_bulk_partition_body( mid, end, cell_size )();
+				}
+			}
+
+			_bulk_point*	begin;
+			_bulk_point*	end;
+			std::size_t		cell_size;
+		};
+
+		/** absorbing entries into close ones within each cell, the kept ones moving to the front of their cell */
+		struct _bulk_absorb_body
+		{
+			_bulk_absorb_body( CFTree& in_tree, cfentry_vec_type& in_entries, std::size_t in_cell_size, std::vector<std::size_t>& in_kept, tbb::combinable< std::vector<handle_type> >& in_merged )
+				: tree(in_tree), entries(in_entries), cell_size(in_cell_size), kept(in_kept), merged(in_merged) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
+			{
+				for( std::size_t c = r.begin() ; c != r.end() ; c++ )
+				{
+					CFEntry* begin = &entries[0] + c * cell_size;
+					CFEntry* end = &entries[0] + (std::min)( ( c + 1 ) * cell_size, entries.size() );
+					CFEntry* last = begin;
+					for( CFEntry* e = begin ; e != end ; e++ )
+					{
+						CFEntry* close = std::min_element( begin, last, CloseEntryLessThan( *e, tree.dist_func ) );
+						if( close != last && tree.absorb_dist_func( *close, *e ) < tree.dist_threshold )
+						{
+							// handles of distinct entries, so no other thread writes the same parent
+							if( tree.handles_tracked && e->handle != (handle_type)invalid_handle )
+							{
+								tree.handle_parent[e->handle] = close->handle;
+								if( e->handle < tree.handles_checkpointed )
+									merged.local().push_back( e->handle );
+							}
+							*close += *e;
+						}
+						else
+						{
+							if( last != e )
+								*last = *e;
+							last++;
+						}
+					}
+					kept[c] = last - begin;
+				}
+			}
+
+			CFTree&										tree;
+			cfentry_vec_type&							entries;
+			std::size_t									cell_size;
+			std::vector<std::size_t>&					kept;
+			tbb::combinable< std::vector<handle_type> >&	merged;
+		};
+
+		/** packing consecutive entries into the nodes of one level, along with the entries of their parents */
+		struct _bulk_pack_body
+		{
+			_bulk_pack_body( const cfentry_vec_type& in_entries, std::vector<CFNode*>& in_level, cfentry_vec_type& in_parents, bool in_leaf )
+				: entries(in_entries), level(in_level), parents(in_parents), leaf(in_leaf) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
+			{
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+				{
+					// nodes of the same level are evenly filled
+					std::size_t begin = entries.size() * i / level.size();
+					std::size_t end = entries.size() * ( i + 1 ) / level.size();
+
+					CFNode* node = leaf ? (CFNode*)new CFNodeLeaf() : (CFNode*)new CFNodeItmd();
+					CFEntry parent( node );
+					for( std::size_t j = begin ; j < end ; j++ )
+					{
+						node->entries[node->size++] = entries[j];
+						parent += entries[j];
+					}
+					level[i] = node;
+					parents[i] = parent;
+				}
+			}
+
+			const cfentry_vec_type&		entries;
+			std::vector<CFNode*>&		level;
+			cfentry_vec_type&			parents;
+			bool						leaf;
+		};
+
+		/** appending the handles merged on one thread */
+		struct _append_handles
+		{
+			_append_handles( std::vector<handle_type>& in_out ) : out(in_out) {}
+			void operator()( const std::vector<handle_type>& handles ) const { out.insert( out.end(), handles.begin(), handles.end() ); }
+
+			std::vector<handle_type>&	out;
+		};
+
+// };
+
+#endif
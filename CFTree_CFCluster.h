@@ -29,10 +29,69 @@
 // {
 
 	public:
+		/** phase 3, clustering leaf entries.
+		 *
+		 * besides the clusters, the tree remembers which cluster each leaf entry went into,
+		 * until the next insertion, so that redist_route() can label data-points by descending the tree.
+		 */
 		void cluster( cfentry_vec_type& entries )
 		{
 			get_entries(entries);
-			_cluster(entries);
+
+			std::vector<boost::int32_t> cids;
+			_cluster(entries, cids);
+			_build_leaf_map(entries, cids);
+		}
+
+		/** phase 3 over leaf entries gathered elsewhere, e.g. from the trees of a CFForest, which become the clusters.
+		 *
+		 * the distance function and threshold of this tree apply, its leaves are left alone.
+		 */
+		void cluster_entries( cfentry_vec_type& entries )
+		{
+			std::vector<boost::int32_t> cids;
+			_cluster(entries, cids);
+		}
+
+		/** final cluster of each leaf entry, in the order of get_entries(), empty if the tree changed since cluster() */
+		const std::vector<boost::int32_t>& leaf_clusters() const { return leaf_cids; }
+
+		/** final cluster of the data-points inserted with handle h, -1 if unknown.
+		 *
+		 * valid after cluster() until the next insertion, see track_handles()
+		 */
+		int resolve_handle( handle_type h ) const
+		{
+			return h < handle_cids.size() ? handle_cids[h] : -1;
+		}
+
+		/** final clusters replaced, e.g. refined by kmeans() or minibatch_kmeans, each leaf entry going into the closest one.
+		 *
+		 * route(), leaf_clusters() and resolve_handle() then follow clusters instead of the ones of cluster().
+		 */
+		void assign_leaves( const cfentry_vec_type& clusters )
+		{
+			_finish_background();
+
+			std::vector<leaf_span> spans;
+			_leaf_spans( spans );
+			std::vector<const CFEntry*> leaf_entries;
+			for( std::size_t s = 0 ; s < spans.size() ; s++ )
+				for( std::size_t i = spans[s].begin ; i < spans[s].leaf->size ; i++ )
+					leaf_entries.push_back( &spans[s].leaf->entries[i] );
+
+			std::vector<float_type> means( clusters.size() * dim );
+			for( std::size_t c = 0 ; c < clusters.size() ; c++ )
+			{
+				float_type inv_n = 1.0 / clusters[c].n;
+				for( std::size_t d = 0 ; d < dim ; d++ )
+					means[c*dim + d] = clusters[c].sum[d] * inv_n;
+			}
+
+			std::vector<boost::int32_t> cids( leaf_entries.size(), 0 );
+			if( !clusters.empty() )
+				tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, leaf_entries.size(), 64 ), _assign_leaf_body( leaf_entries, means, cids ) );
+			_build_leaf_map( clusters, cids );
 		}
 
 	private:
@@ -155,17 +214,39 @@
 				return FALSE;
 			}
 
-			void result( /* inout */cfentry_vec_type& entries )
+			void result( /* inout */cfentry_vec_type& entries, /* out */std::vector<boost::int32_t>& cids )
 			{
 				int j;
 				std::vector<CFEntry> tmpentries( chainptr + 1 );
+				cids.assign( entries.size(), -1 );
 				for( j = 0 ; j <= chainptr ; j++ )
 				{
 					tmpentries[j] = chain[j] < 0 ? cf[-chain[j]-1] : entries[chain[j]-1];
+					label( chain[j], j, cids );
 				}
 				entries = tmpentries;
 			}
 
+			/* for result use only, label all the original entries under a merge */
+			void label( int root, int cid, std::vector<boost::int32_t>& cids )
+			{
+				std::vector<int> stack(1, root);
+				while( !stack.empty() )
+				{
+					int c = stack.back();
+					stack.pop_back();
+
+					// positive: original entry, negative: merged entries
+					if( c > 0 )
+						cids[c-1] = cid;
+					else
+					{
+						stack.push_back( ii[-c-1] );
+						stack.push_back( jj[-c-1] );
+					}
+				}
+			}
+
 			/* for SplitHierarchy use only */
 			int farthest_merge(int chainptr) 
 			{
@@ -256,10 +337,15 @@
 			dist_func_type&			dist_func;
 		};
 
-		void refine_cluster( cfentry_vec_type& entries )
+		void refine_cluster( cfentry_vec_type& entries, /* out */std::vector<boost::int32_t>& cids )
 		{
 			std::vector<bool> merged(entries.size(), false);
 
+			// index of the entry each entry is merged into
+			std::vector<std::size_t> owner(entries.size());
+			for( std::size_t i = 0 ; i < entries.size() ; i++ )
+				owner[i] = i;
+
 			std::vector<std::size_t> not_visited;
 			not_visited.reserve( entries.size() );
 
@@ -269,7 +355,8 @@
 			while( !not_visited.empty() )
 			{
 				// pick any entry
-				CFEntry& ref_entry = entries[not_visited.back()];
+				std::size_t ref = not_visited.back();
+				CFEntry& ref_entry = entries[ref];
 				CFEntry curr_entry = ref_entry;
 				not_visited.pop_back();
 
@@ -283,6 +370,7 @@
 					{
 						curr_entry += e;
 						merged[ v ] = true;
+						owner[ v ] = ref;
 						something_merged = true;
 					}
 				}
@@ -319,28 +407,126 @@
 				cfentry_vec_type& entries;
 			};
 			entries.erase( std::remove_if( entries.begin(), entries.end(), _remove_if_merged_by_item( entries ,merged) ), entries.end());
+
+			// surviving entries are renumbered by erasing merged ones
+			std::vector<boost::int32_t> new_index(merged.size(), -1);
+			boost::int32_t cid = 0;
+			for( std::size_t i = 0 ; i < merged.size() ; i++ )
+			{
+				if( !merged[i] )
+					new_index[i] = cid++;
+			}
+
+			cids.resize( merged.size() );
+			for( std::size_t i = 0 ; i < merged.size() ; i++ )
+				cids[i] = new_index[ owner[i] ];
 		}
 
-		void _cluster( cfentry_vec_type& entries )
+		/** clusters entries in place, cids[i] is the cluster the i-th original entry went into */
+		void _cluster( cfentry_vec_type& entries, std::vector<boost::int32_t>& cids )
 		{
 			int n = (int)entries.size();
 
 			if( n <= 1 )
+			{
+				cids.assign( n, 0 );
 				return;
+			}
 
 			if( dist_func == _DistD0 || dist_func == _DistD1 )
 			{
-				refine_cluster( entries );
+				refine_cluster( entries, cids );
 			}
 			else
 			{
 				HierarchicalClustering h( n - 1, dist_func );
 				h.merge( entries );
 				h.split( dist_threshold );
-				h.result( entries );
+				h.result( entries, cids );
 			}
 		}
 
+		void _build_leaf_map( const cfentry_vec_type& clusters, const std::vector<boost::int32_t>& cids )
+		{
+			leaf_cids = cids;
+
+			std::vector<leaf_span> spans;
+			_leaf_spans( spans );
+			leaf_offsets.clear();
+			std::size_t offset = 0;
+			for( std::size_t s = 0 ; s < spans.size() ; s++ )
+			{
+				leaf_offsets[ spans[s].leaf ] = std::make_pair( offset, spans[s].begin );
+				offset += spans[s].leaf->size - spans[s].begin;
+			}
+			assert( offset == leaf_cids.size() );
+
+			// every handle is resolved at once, so that lookups need no union-find
+			handle_cids.assign( handle_parent.size(), -1 );
+			if( !handle_parent.empty() )
+			{
+				std::size_t i = 0;
+				for( std::size_t s = 0 ; s < spans.size() ; s++ )
+				{
+					for( std::size_t j = spans[s].begin ; j < spans[s].leaf->size ; j++, i++ )
+					{
+						handle_type h = spans[s].leaf->entries[j].handle;
+						if( h != (handle_type)invalid_handle )
+							handle_cids[h] = leaf_cids[i];
+					}
+				}
+				for( handle_type h = 0 ; h < handle_parent.size() ; h++ )
+					handle_cids[h] = handle_cids[ find_handle(h) ];
+			}
+
+			cluster_means.resize( clusters.size() * dim );
+			for( std::size_t c = 0 ; c < clusters.size() ; c++ )
+			{
+				float_type inv_n = 1.0 / clusters[c].n;
+				for( std::size_t d = 0 ; d < dim ; d++ )
+					cluster_means[c*dim + d] = clusters[c].sum[d] * inv_n;
+			}
+		}
+
+		/** closest mean of leaf entries, for assign_leaves() */
+		struct _assign_leaf_body
+		{
+			_assign_leaf_body( const std::vector<const CFEntry*>& in_entries, const std::vector<float_type>& in_means, std::vector<boost::int32_t>& in_cids )
+				: entries(in_entries), means(in_means), cids(in_cids) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
+			{
+				float_type centroid[dim];
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+				{
+					float_type inv_n = 1.0 / entries[i]->n;
+					for( std::size_t d = 0 ; d < dim ; d++ )
+						centroid[d] = entries[i]->sum[d] * inv_n;
+					cids[i] = _closest_mean( centroid, &means[0], means.size() / dim );
+				}
+			}
+
+			const std::vector<const CFEntry*>&	entries;
+			const std::vector<float_type>&		means;
+			std::vector<boost::int32_t>&		cids;
+		};
+
+		/** drop the leaf entry to cluster map, leaves are about to change */
+		void _invalidate_leaf_map()
+		{
+			if( !leaf_cids.empty() )
+			{
+				leaf_cids.clear();
+				leaf_offsets.clear();
+				handle_cids.clear();
+			}
+		}
+
+		std::vector<boost::int32_t>						leaf_cids;		/* final cluster of each leaf entry */
+		boost::unordered_map<const CFNode*, std::pair<std::size_t, std::size_t> >	leaf_offsets;	/* index in leaf_cids of the first entry listed of each leaf, and that entry */
+		std::vector<float_type>							cluster_means;	/* k*dim centroids of the final clusters */
+		std::vector<boost::int32_t>						handle_cids;	/* final cluster of each handle */
+
 // };
 
 
@@ -0,0 +1,535 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+#ifndef __CFTREE_KMEANS_H__
+#define __CFTREE_KMEANS_H__
+
+/************************************************************************/
+/* a partial class of CFTree, k-means refinement of phase 3 clusters
+/************************************************************************/
+
+// class CFTree
+// {
+
+	public:
+		/** Receiver of k-means progress.
+		 *
+		 * iteration() is called on the calling thread once an iteration is over,
+		 * never from inside the parallel passes, so a sink is free to do slow I/O.
+		 */
+		struct kmeans_trace
+		{
+			virtual ~kmeans_trace() {}
+
+			/**
+			 * @param iteration_count	0-based iteration just finished
+			 * @param means				k*dim centroids computed by this iteration
+			 * @param cids				labels of all items assigned by this iteration
+			 */
+			virtual void iteration( std::size_t iteration_count, const std::vector<float_type>& means, const boost::int32_t* cids, std::size_t rows, std::size_t n_changed, float_type max_shift ) = 0;
+		};
+
+		/** kmeans_trace dumping "k-means_iterationN.txt" files like the former redist_kmeans did */
+		struct kmeans_file_trace : public kmeans_trace
+		{
+			kmeans_file_trace( const std::string& in_prefix = "k-means_iteration" ) : prefix(in_prefix) {}
+
+			virtual void iteration( std::size_t iteration_count, const std::vector<float_type>& means, const boost::int32_t* cids, std::size_t rows, std::size_t /*n_changed*/, float_type /*max_shift*/ )
+			{
+				std::stringstream ss;
+				ss << prefix << iteration_count << ".txt";
+				std::ofstream fout( ss.str().c_str() );
+
+				for( std::size_t c = 0 ; c < means.size() / dim ; c++ )
+				{
+					fout << "(" << c << ") ";
+					for( std::size_t d = 0 ; d < dim ; d++ )
+						fout << means[c*dim + d] << (d == dim-1 ? "" : "," );
+					fout << '\n';
+				}
+				fout << '\n';
+
+				for( std::size_t i = 0 ; i < rows ; i++ )
+					fout << i << ":" << cids[i] << '\n';
+			}
+
+			std::string prefix;
+		};
+
+		/** parameters of kmeans() */
+		struct kmeans_params
+		{
+			kmeans_params() : max_iteration(0), changed_ratio(0.0), shift(0.0), grain_size(256), keep_cids(false), trace(NULL) {}
+
+			std::size_t		max_iteration;	/** upper bound of iterations, 0 means until converged */
+			float_type		changed_ratio;	/** converged when the fraction of relabeled items is not larger than this */
+			float_type		shift;			/** converged when no centroid moved farther than this */
+			std::size_t		grain_size;		/** # items a parallel task handles at least */
+			bool			keep_cids;		/** regard the incoming cids as the previous labeling, otherwise every item starts unlabeled */
+			kmeans_trace*	trace;			/** optional progress sink */
+		};
+
+		/** summary of a kmeans() run */
+		struct kmeans_stats
+		{
+			kmeans_stats() : iteration_count(0), n_changed(0), max_shift(0.0) {}
+
+			std::size_t		iteration_count;
+			std::size_t		n_changed;	/** # relabeled items at the last iteration */
+			float_type		max_shift;	/** the largest centroid move at the last iteration */
+		};
+
+		/** k-means refinement of items in a caller's array, starting from the centroids of entries.
+		 *
+		 * Lloyd iterations run in parallel; every thread sums its items up in its own CFEntries,
+		 * so on return entries hold the exact clustering features of the refined clusters.
+		 * An entry which lost all of its items is kept as it was.
+		 *
+		 * @param items		items, read in place
+		 * @param entries	[in] initial clusters, e.g. the output of cluster(), [out] refined clusters
+		 * @param out_cid	[out] items.rows labels, indices to entries
+		 */
+		template<typename T>
+		kmeans_stats kmeans( const basic_matrix_view<T>& items, cfentry_vec_type& entries, boost::int32_t* out_cid, const kmeans_params& params = kmeans_params() )
+		{
+			return _kmeans( items, items.rows, entries, out_cid, params );
+		}
+
+		/** k-means refinement of items in a caller's array, labels go to a caller's buffer
+		 *
+		 * @param iteration	the maximum # iterations, 0 means until no item changes its label
+		 */
+		template<typename T>
+		void redist_kmeans( const basic_matrix_view<T>& items, cfentry_vec_type& entries, boost::int32_t* out_cid, std::size_t iteration = 2, kmeans_trace* trace = NULL )
+		{
+			kmeans_params params;
+			params.max_iteration = iteration;
+			params.trace = trace;
+			_kmeans( items, items.rows, entries, out_cid, params );
+		}
+
+		/** k-means refinement of items, labeling items through their cid().
+		 *
+		 * @param iteration	the maximum # iterations, 0 means until no item changes its label
+		 * @param trace		optional progress sink, e.g. kmeans_file_trace
+		 */
+		template<typename item_list_type>
+		void redist_kmeans( item_list_type& items, cfentry_vec_type& entries, std::size_t iteration = 2, kmeans_trace* trace = NULL )
+		{
+			if( items.empty() )
+				return;
+
+			assert(items[0].size() == dim);
+
+			std::vector<boost::int32_t> cids( items.size() );
+			for( std::size_t i = 0 ; i < items.size() ; i++ )
+				cids[i] = items[i].cid();
+
+			kmeans_params params;
+			params.max_iteration = iteration;
+			params.keep_cids = true;
+			params.trace = trace;
+			_kmeans( _item_rows<item_list_type>(items), items.size(), entries, &cids[0], params );
+
+			for( std::size_t i = 0 ; i < items.size() ; i++ )
+				items[i].cid() = cids[i];
+		}
+
+	public:
+		/** Sequential source of items for passes which cannot hold all items in memory. */
+		struct item_source
+		{
+			virtual ~item_source() {}
+
+			/** fill buf with at most max_rows items, dim float_types each, and return # items filled, 0 at the end */
+			virtual std::size_t next( float_type* buf, std::size_t max_rows ) = 0;
+		};
+
+		/** item_source reading whitespace separated items, one per line, from a stream, e.g. std::ifstream */
+		struct istream_item_source : public item_source
+		{
+			istream_item_source( std::istream& in_is ) : is(in_is) {}
+
+			virtual std::size_t next( float_type* buf, std::size_t max_rows )
+			{
+				std::size_t rows = 0;
+				std::string line;
+				while( rows < max_rows && std::getline( is, line ) )
+				{
+					std::stringstream ss(line);
+					float_type* item = buf + rows * dim;
+					std::size_t k = 0;
+					while( k < dim && ss >> item[k] )
+						k++;
+					if( k == 0 )
+						continue;	// blank line
+					std::fill( item + k, item + dim, 0.0 );
+					rows++;
+				}
+				return rows;
+			}
+
+			std::istream& is;
+		};
+
+		/** Receiver of labels produced batch by batch */
+		struct label_sink
+		{
+			virtual ~label_sink() {}
+			virtual void labels( const boost::int32_t* cids, std::size_t rows ) = 0;
+		};
+
+		/** parameters of redist_minibatch() */
+		struct minibatch_params
+		{
+			minibatch_params() : batch_size(4096), max_batches(0), warm_counts(true), grain_size(256) {}
+
+			std::size_t		batch_size;		/** # items per batch */
+			std::size_t		max_batches;	/** upper bound of batches, 0 means until the source runs out */
+			bool			warm_counts;	/** count the seed entries' data-points, so that well populated centers move slowly from the start */
+			std::size_t		grain_size;		/** # items a parallel task handles at least */
+		};
+
+		/** Mini-batch k-means state (Sculley, "Web-scale k-means clustering", 2010).
+		 *
+		 * Each center has its own learning rate 1/(# data-points it has absorbed),
+		 * so memory is k centers no matter how many batches are fed.
+		 */
+		class minibatch_kmeans
+		{
+		public:
+			/** seeded by k entries, e.g. the output of cluster() */
+			minibatch_kmeans( const cfentry_vec_type& in_seeds, bool warm_counts = true, std::size_t in_grain_size = 256 )
+				: seeds(in_seeds), means(in_seeds.size() * dim), sq_means(in_seeds.size(), 0.0), counts(in_seeds.size(), 0), grain_size(in_grain_size)
+			{
+				for( std::size_t c = 0 ; c < seeds.size() ; c++ )
+				{
+					const CFEntry& e = seeds[c];
+					float_type inv_n = 1.0 / e.n;
+					for( std::size_t d = 0 ; d < dim ; d++ )
+						means[c*dim + d] = e.sum[d] * inv_n;
+					sq_means[c] = e.sum_sq * inv_n;
+					if( warm_counts )
+						counts[c] = e.n;
+				}
+				seed_counts = counts;
+			}
+
+			/** # centers */
+			std::size_t size() const { return counts.size(); }
+
+			/** move centers towards one batch of items */
+			template<typename T>
+			void update( const basic_matrix_view<T>& batch )
+			{
+				if( batch.rows == 0 || size() == 0 )
+					return;
+
+				cids.resize( batch.rows );
+				label( batch, &cids[0] );
+
+				// gradient steps are sequential, each one depends on the count before it
+				for( std::size_t i = 0 ; i < batch.rows ; i++ )
+				{
+					const T* item = batch[i];
+					std::size_t c = cids[i];
+					float_type eta = 1.0 / ++counts[c];
+					float_type* mean = &means[c*dim];
+					for( std::size_t d = 0 ; d < dim ; d++ )
+						mean[d] += eta * ((float_type)item[d] - mean[d]);
+					sq_means[c] += eta * (_sq_norm(item) - sq_means[c]);
+				}
+			}
+
+			/** label one batch of items with the closest centers */
+			template<typename T>
+			void label( const basic_matrix_view<T>& batch, boost::int32_t* out_cid ) const
+			{
+				if( size() == 0 )
+					return;
+				tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, batch.rows, (std::max)( grain_size, (std::size_t)1 ) ), _label_body<T>( batch, means, size(), out_cid ) );
+			}
+
+			/** current centers as clustering features, a center which never moved keeps its seed */
+			void get_entries( cfentry_vec_type& out_entries ) const
+			{
+				out_entries = seeds;
+				for( std::size_t c = 0 ; c < size() ; c++ )
+				{
+					if( counts[c] == seed_counts[c] )
+						continue;
+
+					CFEntry& e = out_entries[c];
+					e.n = counts[c];
+					for( std::size_t d = 0 ; d < dim ; d++ )
+						e.sum[d] = means[c*dim + d] * counts[c];
+					e.sum_sq = sq_means[c] * counts[c];
+				}
+			}
+
+		private:
+			template<typename T>
+			struct _label_body
+			{
+				_label_body( const basic_matrix_view<T>& in_batch, const std::vector<float_type>& in_means, std::size_t in_k, boost::int32_t* in_cids )
+					: batch(in_batch), means(in_means), k(in_k), cids(in_cids) {}
+
+				void operator()( const tbb::blocked_range<std::size_t>& r ) const
+				{
+					for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+						cids[i] = _closest_mean( batch[i], &means[0], k );
+				}
+
+				basic_matrix_view<T>			batch;
+				const std::vector<float_type>&	means;
+				std::size_t						k;
+				boost::int32_t*					cids;
+			};
+
+			cfentry_vec_type			seeds;
+			std::vector<float_type>		means;		/* k*dim centers */
+			std::vector<float_type>		sq_means;	/* running mean of squared norms, keeps sum_sq of get_entries() meaningful */
+			std::vector<std::size_t>	counts;		/* # data-points absorbed per center */
+			std::vector<std::size_t>	seed_counts;
+			std::vector<boost::int32_t>	cids;		/* labels of the current batch */
+			std::size_t					grain_size;
+		};
+
+		/** mini-batch k-means refinement streaming items from a source.
+		 *
+		 * Memory is bounded by one batch plus k centers, so datasets larger than RAM can be refined.
+		 *
+		 * @param source		items used for training, consumed batch by batch
+		 * @param entries		[in] initial clusters, e.g. the output of cluster(), [out] refined clusters
+		 * @param label_source	optional, items labeled with the final centers in a single pass; it could be the same data as source, read again
+		 * @param sink			receiver of the labels of label_source
+		 * @return # batches used for training
+		 */
+		std::size_t redist_minibatch( item_source& source, cfentry_vec_type& entries, const minibatch_params& params = minibatch_params(), item_source* label_source = NULL, label_sink* sink = NULL )
+		{
+			std::size_t batch_size = (std::max)( params.batch_size, (std::size_t)1 );
+			std::vector<float_type> batch( batch_size * dim );
+
+			minibatch_kmeans mbk( entries, params.warm_counts, params.grain_size );
+
+			std::size_t n_batches = 0;
+			while( params.max_batches == 0 || n_batches < params.max_batches )
+			{
+				std::size_t rows = source.next( &batch[0], batch_size );
+				if( rows == 0 )
+					break;
+				mbk.update( matrix_view( &batch[0], rows ) );
+				n_batches++;
+			}
+
+			mbk.get_entries( entries );
+
+			if( label_source && sink )
+			{
+				std::vector<boost::int32_t> cids( batch_size );
+				for( ;; )
+				{
+					std::size_t rows = label_source->next( &batch[0], batch_size );
+					if( rows == 0 )
+						break;
+					mbk.label( matrix_view( &batch[0], rows ), &cids[0] );
+					sink->labels( &cids[0], rows );
+				}
+			}
+
+			return n_batches;
+		}
+
+	private:
+		/** row accessor of an item list whose items are contiguous float_type arrays */
+		template<typename item_list_type>
+		struct _item_rows
+		{
+			typedef float_type value_type;
+
+			_item_rows( item_list_type& in_items ) : items(in_items) {}
+			const float_type* operator()( std::size_t i ) const { return &items[i][0]; }
+
+			item_list_type&	items;
+		};
+
+		/** per-thread sums of one pass */
+		struct _kmeans_partial
+		{
+			_kmeans_partial() : n_changed(0) {}
+			_kmeans_partial( std::size_t k ) : clusters(k), n_changed(0) {}
+
+			cfentry_vec_type	clusters;
+			std::size_t			n_changed;
+		};
+
+		struct _kmeans_partial_init
+		{
+			_kmeans_partial_init( std::size_t in_k ) : k(in_k) {}
+			_kmeans_partial operator()() const { return _kmeans_partial(k); }
+
+			std::size_t k;
+		};
+
+		/** index of the closest centroid among k means */
+		template<typename T>
+		static boost::int32_t _closest_mean( const T* item, const float_type* means, std::size_t k )
+		{
+			boost::int32_t	cid = 0;
+			float_type		min_dist = (std::numeric_limits<float_type>::max)();
+			for( std::size_t c = 0 ; c < k ; c++ )
+			{
+				float_type dist = euclidean_intrinsic( dim, item, means + c * dim, 1.0, 1.0 );
+				if( min_dist > dist )
+				{
+					min_dist = dist;
+					cid = (boost::int32_t)c;
+				}
+			}
+			return cid;
+		}
+
+		/** add one data-point to a CFEntry without materializing a CFEntry for it */
+		template<typename T>
+		static void _add_item( CFEntry& e, const T* item )
+		{
+			_add_widened( item, e.sum );
+			e.sum_sq += _sq_norm( item );
+			e.n++;
+		}
+
+		/** assignment step fused with the partial sums of the update step */
+		template<typename rows_type>
+		struct _kmeans_assign
+		{
+			_kmeans_assign( const rows_type& in_rows, const std::vector<float_type>& in_means, boost::int32_t* in_cids, tbb::combinable<_kmeans_partial>& in_partials )
+				: rows(in_rows), means(in_means), cids(in_cids), partials(in_partials) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
+			{
+				_kmeans_partial& p = partials.local();
+				std::size_t k = p.clusters.size();
+
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+				{
+					const typename rows_type::value_type* item = rows(i);
+					boost::int32_t cid = _closest_mean( item, &means[0], k );
+					if( cids[i] != cid )
+					{
+						cids[i] = cid;
+						p.n_changed++;
+					}
+					_add_item( p.clusters[cid], item );
+				}
+			}
+
+			const rows_type&					rows;
+			const std::vector<float_type>&		means;
+			boost::int32_t*						cids;
+			tbb::combinable<_kmeans_partial>&	partials;
+		};
+
+		template<typename rows_type>
+		kmeans_stats _kmeans( const rows_type& rows, std::size_t n_rows, cfentry_vec_type& entries, boost::int32_t* cids, const kmeans_params& params )
+		{
+			kmeans_stats stats;
+			std::size_t k = entries.size();
+			if( n_rows == 0 || k == 0 )
+				return stats;
+
+			// start from k means from k entries
+			std::vector<float_type> means( k * dim );
+			for( std::size_t c = 0 ; c < k ; c++ )
+			{
+				const CFEntry& e = entries[c];
+				float_type inv_n = 1.0 / e.n;
+				for( std::size_t d = 0 ; d < dim ; d++ )
+					means[c*dim + d] = e.sum[d] * inv_n;
+			}
+
+			if( !params.keep_cids )
+				std::fill( cids, cids + n_rows, -1 );
+
+			std::size_t max_iteration = params.max_iteration == 0 ? (std::numeric_limits<std::size_t>::max)() : params.max_iteration;
+			cfentry_vec_type clusters( k );
+
+			while( stats.iteration_count < max_iteration )
+			{
+				tbb::combinable<_kmeans_partial> partials( (_kmeans_partial_init(k)) );
+				tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_rows, (std::max)( params.grain_size, (std::size_t)1 ) ), _kmeans_assign<rows_type>( rows, means, cids, partials ) );
+
+				// reduce partial sums of all threads
+				std::fill( clusters.begin(), clusters.end(), CFEntry() );
+				stats.n_changed = 0;
+				std::vector< _kmeans_partial* > locals;
+				partials.combine_each( _collect_partial( locals ) );
+				for( std::size_t t = 0 ; t < locals.size() ; t++ )
+				{
+					for( std::size_t c = 0 ; c < k ; c++ )
+						clusters[c] += locals[t]->clusters[c];
+					stats.n_changed += locals[t]->n_changed;
+				}
+
+				// new centroids, an emptied cluster keeps the previous one
+				stats.max_shift = 0.0;
+				for( std::size_t c = 0 ; c < k ; c++ )
+				{
+					if( clusters[c].n == 0 )
+						continue;
+
+					float_type inv_n = 1.0 / clusters[c].n;
+					float_type shift = 0.0;
+					for( std::size_t d = 0 ; d < dim ; d++ )
+					{
+						float_type m = clusters[c].sum[d] * inv_n;
+						shift += (m - means[c*dim + d]) * (m - means[c*dim + d]);
+						means[c*dim + d] = m;
+					}
+					stats.max_shift = (std::max)( stats.max_shift, std::sqrt(shift) );
+				}
+
+				if( params.trace )
+					params.trace->iteration( stats.iteration_count, means, cids, n_rows, stats.n_changed, stats.max_shift );
+
+				stats.iteration_count++;
+
+				if( stats.n_changed <= params.changed_ratio * n_rows || stats.max_shift <= params.shift )
+					break;
+			}
+
+			for( std::size_t c = 0 ; c < k ; c++ )
+			{
+				if( clusters[c].n > 0 )
+					entries[c] = clusters[c];
+			}
+
+			return stats;
+		}
+
+		struct _collect_partial
+		{
+			_collect_partial( std::vector< _kmeans_partial* >& in_locals ) : locals(in_locals) {}
+			void operator()( _kmeans_partial& p ) const { locals.push_back( &p ); }
+
+			std::vector< _kmeans_partial* >& locals;
+		};
+
+// };
+
+#endif
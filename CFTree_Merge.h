@@ -0,0 +1,109 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+#ifndef __CFTREE_MERGE_H__
+#define __CFTREE_MERGE_H__
+
+/************************************************************************/
+/* a partial class of CFTree, merging trees built on separate shards
+/************************************************************************/
+
+// class CFTree
+// {
+
+	public:
+		/** merging the sub-clusters of another tree, e.g. one built on another shard of the data-points.
+		 *
+		 * CF entries being additive, the leaf entries of other are inserted like the ones of a rebuild,
+		 * so merging trees pairwise in a reduction tree summarizes the whole data set.
+		 * if this tree tracks handles, a handle h of other becomes handle_count() + h, handle_count() before merging.
+		 *
+		 * @param reconcile	if other was built with a larger threshold, this tree takes it and rebuilds first,
+		 *					so that both sides are summarized at the same range
+		 *
+		 * the entries other has yet to move in an incremental rebuild are merged too, but a background rebuild holds
+		 * data-points in its side tree, so other must not be rebuilding in the background, see finish_rebuild().
+		 * @throw CFTreeRebuilding if it is
+		 */
+		void merge( const CFTree& other, bool reconcile = true )
+		{
+			if( &other == this )
+				return;
+			if( other.background )
+				throw CFTreeRebuilding();
+
+			std::vector<leaf_span> spans;
+			other._leaf_spans( spans );
+			cfentry_vec_type entries;
+			for( std::size_t i = 0 ; i < spans.size() ; i++ )
+				entries.insert( entries.end(), spans[i].leaf->entries + spans[i].begin, spans[i].leaf->entries + spans[i].leaf->size );
+			entries.insert( entries.end(), other.warm_up_entries.begin(), other.warm_up_entries.end() );
+
+			merge_entries( entries, reconcile ? other.dist_threshold : 0, other.handle_parent.empty() ? NULL : &other.handle_parent[0], other.handle_parent.size() );
+		}
+
+		/** merging the sub-clusters of a tree saved by save() on another worker */
+		void merge( const snapshot_view& other, bool reconcile = true )
+		{
+			cfentry_vec_type entries;
+			other.get_entries( entries );
+
+			std::vector<handle_type> parents( other.handle_parents(), other.handle_parents() + other.header().handle_count );
+			merge_entries( entries, reconcile ? other.header().dist_threshold : 0, parents.empty() ? NULL : &parents[0], parents.size() );
+		}
+
+		/** merging leaf entries, e.g. saved by save_entries_npy().
+		 *
+		 * @param threshold		threshold the entries were summarized at, this tree takes it if larger
+		 * @param parents		optional, handle forest of the entries' handles
+		 * @param n_handles		# handles in parents
+		 */
+		void merge_entries( cfentry_vec_type& entries, float_type threshold = 0, const handle_type* parents = NULL, std::size_t n_handles = 0 )
+		{
+			finish_rebuild();
+
+			if( threshold > dist_threshold )
+			{
+				dist_threshold = threshold;
+				rebuild(false);
+			}
+
+			// handles of the other side follow ours, entries without handles get new ones when inserted
+			std::size_t handle_base = handle_parent.size();
+			if( handles_tracked && parents )
+			{
+				for( std::size_t h = 0 ; h < n_handles ; h++ )
+					handle_parent.push_back( handle_base + parents[h] );
+			}
+
+			for( std::size_t i = 0 ; i < entries.size() ; i++ )
+			{
+				CFEntry& e = entries[i];
+				e.child = NULL;
+				if( !handles_tracked || !parents || e.handle >= n_handles )
+					e.handle = (handle_type)invalid_handle;
+				else
+					e.handle += handle_base;
+				insert( e );
+			}
+		}
+
+// };
+
+#endif
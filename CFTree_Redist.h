@@ -23,290 +23,302 @@
 // class CFTree
 // {
 
-	private:
-		bool _has_differences( std::vector<ublas_vec_type>& lhs, std::vector<ublas_vec_type>& rhs)
-		{
-			assert( lhs.size() == rhs.size() );
-
-			for( std::size_t i = 0 ; i < lhs.size() ; i++ )
-			{
-				if( norm_2(lhs[i] - rhs[i]) > std::numeric_limits<float_type>::epsilon() )
-					return true;
-			}
-			return false;
-		}
-
-		bool _has_differences( std::vector<ublas_vec_type>& lhs, std::vector<ublas_vec_type>& rhs, std::vector<bool>& active )
-		{
-			assert( lhs.size() == rhs.size() );
-
-			for( std::size_t i = 0 ; i < lhs.size() ; i++ )
-				active[i] = norm_2(lhs[i] - rhs[i]) > std::numeric_limits<float_type>::epsilon();
-
-			return std::count( active.begin(), active.end(), true ) > 0;
-		}
-
 	public:
+		/************************************************************************/
+		/* The original redistribution code of birch
+		/* In my view point, it could be burdensome due to O(n^2) cost
+		/************************************************************************/
 
-		template<typename item_list_type>
-		void redist_kmeans( item_list_type& items, cfentry_vec_type& entries, std::size_t iteration = 2 )
+		/** Subclusters prepared for redistribution.
+		 *
+		 * centers sorted by norm and their pairwise distances are computed once by prepare_redist(),
+		 * then any number of data-points can be labeled against them.
+		 * query() doesn't modify the index, so it can be called from several threads at once.
+		 */
+		class redist_index
 		{
-			using namespace boost::numeric::ublas;
-			
-			if( items.empty() )
-				return;
+		public:
+			redist_index() {}
 
-			assert(items[0].size() == dim);
+			/** # subclusters */
+			std::size_t size() const { return order.size(); }
 
-			// start from k means from k entries
-			std::vector<ublas_vec_type> prev_means(entries.size());
-			std::vector<ublas_vec_type> means(entries.size());
-			for( std::size_t i = 0 ; i < means.size() ; i++ )
+			/** index to the entries of the closest subcluster centroid to a data-point, -1 if there's no subcluster */
+			template<typename T>
+			int query( const T* item ) const
 			{
-				prev_means[i].resize( dim );
-				prev_means[i].clear();
+				std::size_t n = size();
+				if( n == 0 )
+					return -1;
 
-				CFEntry& e = entries[i];
-				ublas_vec_type& mean = means[i];
+				float_type tmpnorm = std::sqrt( _sq_norm( item ) );
 
-				mean.resize( dim );
-				std::copy( e.sum, e.sum + dim, mean.begin() );
-				mean /= e.n;
-			}
+				// i=ClosestNorm(tmpnorm,norms,0,n-1);
+				std::size_t i = std::lower_bound( norms.begin(), norms.end(), tmpnorm ) - norms.begin();
+				if( i == n || ( i > 0 && tmpnorm - norms[i-1] < norms[i] - tmpnorm ) )
+					i--;
 
-			// until it is converged
-			std::size_t iteration_count = 0;
-			if( iteration == 0 )
-				iteration = (std::numeric_limits<std::size_t>::max)();
+				float_type idist = euclidean_intrinsic( dim, item, center(i), 1.0, 1.0 );
 
-			bool active = true;
+				// imin=MinLargerThan(tmpnorm-sqrt(idist),norms,0,n-1);
+				// imax=MaxSmallerThan(tmpnorm+sqrt(idist),norms,0,n-1);
+				// no closer center can be out of this range of norms, by the triangle inequality
+				std::size_t imin = std::lower_bound( norms.begin(), norms.end(), tmpnorm - std::sqrt(idist) ) - norms.begin();
+				std::size_t imax = std::upper_bound( norms.begin(), norms.end(), tmpnorm + std::sqrt(idist) ) - norms.begin();
 
-			//while( iteration_count < iteration && _has_differences( prev_means, means ) )
-			while( iteration_count < iteration && active )
-			{
-				active = false;
-				for( item_list_type::iterator item_it = items.begin() ; item_it != items.end() ; ++item_it )
+				// ClosestCenter(i,idist,tmpv,centers,imin,imax,matrix,n);
+				for( std::size_t k = imin ; k < imax ; k++ )
 				{
-					item_list_type::value_type& item = *item_it;
-					float_type min_dist = (std::numeric_limits<float_type>::max)();
-
-					int prev_cid = item.cid();
-
-					for( std::size_t cid = 0 ; cid < means.size() ; ++cid )
+					if( center_dist(k, i) <= 4*idist )
 					{
-						ublas_vec_type diff(dim);
-						std::transform( &item[0], &item[0] + dim, means[cid].begin(), diff.begin(), std::minus<float_type>() );
-						float_type dist = norm_2( diff );
-
-						if( min_dist > dist )
+						float_type d = euclidean_intrinsic( dim, item, center(k), 1.0, 1.0 );
+						if( d < idist )
 						{
-							min_dist = dist;
-							item_it->cid() = cid;
+							idist = d;
+							i = k;
 						}
 					}
-
-					if( prev_cid != item.cid() )
-						active = true;
 				}
+				return order[i];
+			}
 
-				std::stringstream ss;
-				ss << "k-means_iteration" << iteration_count << ".txt";
-				std::ofstream fout( ss.str().c_str() );
+		private:
+			friend class CFTree;
 
-				for( std::size_t c = 0 ; c < means.size() ; c++ )
-				{
-					fout << "(" << c << ") ";
-					for( std::size_t d = 0 ; d < dim ; d++ )
-						fout << means[c][d] << (d == dim-1 ? "" : "," );
-					fout << std::endl;
-				}
-				fout << std::endl;
+			const float_type* center( std::size_t i ) const { return &centers[i*dim]; }
 
-				for( std::size_t i = 0 ; i < items.size() ; i++ )
-					fout << i << ":" << items[i].cid() << std::endl;
-				fout.close();
+			/** squared distance between two centers, from the packed lower triangle */
+			float_type center_dist( std::size_t i, std::size_t j ) const
+			{
+				if( i < j )
+					std::swap( i, j );
+				return dist_mat[ i*(i+1)/2 + j ];
+			}
 
-				// store means to prev_means and zeoring means
-				prev_means = means;
-				for( std::size_t i = 0 ; i < means.size() ; i++ )
-					means[i].clear();
+			std::vector<int>			order;		/* index to the entries of each sorted subcluster */
+			std::vector<float_type>		centers;	/* centers sorted by norm, dim float_types each */
+			std::vector<float_type>		norms;		/* ascending norms of centers */
+			std::vector<float_type>		dist_mat;	/* packed lower triangle of squared distances between centers */
+		};
 
-				// rearrange means and count # items for each cluster
-				std::vector<std::size_t> mean_counts(means.size(), 0);
-				for( item_list_type::iterator item_it = items.begin() ; item_it != items.end() ; ++item_it )
-				{
-					item_list_type::value_type& item = *item_it;
-					std::transform( &item[0], &item[0] + dim, means[item.cid()].begin(), means[item.cid()].begin(), std::plus<float_type>() );
-					++mean_counts[item.cid()];
-				}
+		/** build the redistribution index of entries, e.g. the output of cluster() */
+		void prepare_redist( const cfentry_vec_type& entries, redist_index& index ) const
+		{
+			std::size_t n = entries.size();
 
-				// averaging means to calculate centroids
-				for( std::size_t i = 0 ; i < means.size() ; i++ )
-					means[i] /= mean_counts[i];
+			// sort subclusters by the norms of their centers
+			std::vector<float_type> centers( n * dim );
+			std::vector< std::pair<float_type, int> > norm_order( n );
+			for( std::size_t i = 0 ; i < n ; i++ )
+			{
+				const CFEntry& e = entries[i];
+				float_type* center = &centers[i*dim];
+				float_type inv_n = 1.0 / e.n;
+				for( std::size_t d = 0 ; d < dim ; d++ )
+					center[d] = e.sum[d] * inv_n;
+				norm_order[i] = std::make_pair( std::sqrt( _sq_norm( center ) ), (int)i );
+			}
+			std::sort( norm_order.begin(), norm_order.end() );
 
-				iteration_count++;
+			index.order.resize( n );
+			index.norms.resize( n );
+			index.centers.resize( n * dim );
+			for( std::size_t i = 0 ; i < n ; i++ )
+			{
+				index.norms[i] = norm_order[i].first;
+				index.order[i] = norm_order[i].second;
+				std::copy( &centers[ norm_order[i].second * dim ], &centers[ norm_order[i].second * dim ] + dim, &index.centers[i*dim] );
 			}
-			//std::cout << "iteration count = " << iteration_count << std::endl;
+
+			// in addition to an individual summary for each subcluster
+			// calculate pairwise euclidean distances of subclusters
+			index.dist_mat.resize( n*(n+1)/2 );
+			tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n ), _dist_mat_body( index ) );
 		}
 
-		/************************************************************************/
-		/* The original redistribution code of birch
-		/* In my view point, it could be burdensome due to O(n^2) cost
-		/************************************************************************/
-		struct subcluster_summary
+		/** label data-points against a prepared index, in parallel */
+		template<typename _iter>
+		void redist( const redist_index& index, _iter begin, _iter end, std::vector<int>& out_cid ) const
 		{
-			subcluster_summary( ) : radius(0.0), norm(0.0) {}
-			subcluster_summary( const ublas_vec_type& in_center, const float_type& in_radius, const float_type& in_norm ) : center( in_center ), radius(in_radius), norm(in_norm) {}
-			//subcluster_summary( float_type* in_center, float_type& in_radius, float_type& in_norm ) : center( in_center, in_center + dim ), radius(in_radius), norm(in_norm) {}
-
-			ublas_vec_type	center;
-			float_type		radius;
-			float_type		norm;
-		};
-
-		typedef std::vector< subcluster_summary > subsum_vec_type;
+			out_cid.resize( end - begin );
+			if( !out_cid.empty() )
+				tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, out_cid.size(), 256 ), _redist_body< _iter_rows<_iter>, int >( index, _iter_rows<_iter>(begin), &out_cid[0] ) );
+		}
 
-		struct subcluster_lessthan_norm
+		/** label data-points in a caller's array against a prepared index, in parallel.
+		 *
+		 * nothing is copied, labels are written to out_cid which has room for items.rows labels
+		 */
+		template<typename T>
+		void redist( const redist_index& index, const basic_matrix_view<T>& items, boost::int32_t* out_cid ) const
 		{
-			bool operator() ( const subcluster_summary& lhs, const subcluster_summary& rhs ) const { return (lhs.norm) < (rhs.norm); }
-		};
+			tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, items.rows, 256 ), _redist_body< basic_matrix_view<T>, boost::int32_t >( index, items, out_cid ) );
+		}
 
+		/** label data-points with the closest subclusters among entries */
 		template<typename _iter>
 		void redist( _iter begin, _iter end, cfentry_vec_type& entries, std::vector<int>& out_cid )
 		{
-			using namespace boost::numeric::ublas;
+			redist_index index;
+			prepare_redist( entries, index );
+			redist( index, begin, end, out_cid );
+		}
 
-			// prepare summaries for each subcluster
-			// summaries = ( center, radius, norm )
-			subsum_vec_type subclusters;
-			subclusters.reserve(entries.size());
-			for( std::size_t i = 0 ; i < entries.size() ; i++ )
-			{
-				const CFEntry& e = entries[i];
-				ublas_vec_type center(dim);
-				std::copy(e.sum, e.sum + dim, center.begin());
-				center /= e.n;
-				subclusters.push_back( subcluster_summary( center, _Radius(e), std::sqrt(inner_prod(center, center) )) ); 
-			}
 
-			std::sort( subclusters.begin(), subclusters.end(), subcluster_lessthan_norm() );
+		/** label a data-point by descending the tree, cluster() must have been called after the last insertion.
+		 *
+		 * the data-point goes down to its closest leaf entry the way an insertion would, O(fanout * depth),
+		 * and inherits the cluster of that entry, so the cost does not depend on the # clusters.
+		 * during an incremental rebuild, it goes down the previous nodes too.
+		 *
+		 * @param fallback_margin	if the two closest leaf entries belong to different clusters and
+		 *							their distances differ by less than this ratio, the data-point is
+		 *							compared against all the cluster centroids instead; 0 disables the fallback
+		 * @return index to the entries cluster() returned, -1 if there's no cluster map
+		 */
+		template<typename T>
+		int route( const T* item, float_type fallback_margin = 0.0 ) const
+		{
+			if( leaf_cids.empty() )
+				return -1;
 
-			// in addition to an individual summary for each subcluster
-			// calculate pairwise euclidean distances of subclusters
-			std::size_t n = subclusters.size();
-			ublas_sym_matrix_type dist_mat(n,n);
-			for( std::size_t i = 0 ; i < n-1 ; i++ )
-			{
-				for( std::size_t j = i+1 ; j < n ; j++ )
-				{
-					ublas_vec_type diff = subclusters[i].center - subclusters[j].center;
-					dist_mat(i,j) = inner_prod(diff, diff);
-				}
-			}
+			CFEntry e( item );
+			_route_candidates c;
+			_route_leaf( root, e, c );
+			// the entries of an incremental rebuild not moved yet
+			if( _migrating_root() )
+				_route_leaf( _migrating_root(), e, c );
+
+			int cid = c.cid_first;
+			if( fallback_margin > 0.0 && c.cid_second >= 0 && c.cid_second != cid && c.d_second <= c.d_first * (1.0 + fallback_margin) )
+				cid = _closest_mean( item, &cluster_means[0], cluster_means.size() / dim );
+
+			return cid;
+		}
 
+		/** label data-points by route() */
+		template<typename _iter>
+		void redist_route( _iter begin, _iter end, std::vector<int>& out_cid, float_type fallback_margin = 0.0 ) const
+		{
 			out_cid.clear();
 			out_cid.reserve(end - begin);
 			for( _iter it = begin ; it != end ; it++ )
-			{
-				ublas_vec_type v(dim);
-				std::copy(&(*it)[0], &(*it)[0] + dim, v.begin());
-				out_cid.push_back( _redist( v, subclusters, dist_mat ) );
-			}
+				out_cid.push_back( route( &(*it)[0], fallback_margin ) );
+		}
+
+		/** label data-points in a caller's array by route(), in parallel */
+		template<typename T>
+		void redist_route( const basic_matrix_view<T>& items, boost::int32_t* out_cid, float_type fallback_margin = 0.0 ) const
+		{
+			tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, items.rows, 256 ), _route_body<T>( *this, items, out_cid, fallback_margin ) );
 		}
 
 	private:
+		/** the closest and the second closest leaf entries route() found so far */
+		struct _route_candidates
+		{
+			_route_candidates() : d_first((std::numeric_limits<float_type>::max)()), d_second((std::numeric_limits<float_type>::max)()), cid_first(-1), cid_second(-1) {}
 
-		int _redist( ublas_vec_type& tmpv, subsum_vec_type& subsums, ublas_sym_matrix_type& dist_mat )
+			float_type	d_first;
+			float_type	d_second;
+			int			cid_first;
+			int			cid_second;
+		};
+
+		/** descending from node to a leaf as an insertion would, and comparing its listed entries to the candidates */
+		void _route_leaf( const CFNode* node, const CFEntry& e, _route_candidates& c ) const
 		{
-			int    imin,imax,i,k,n,start,end,median;
-			double d,tmpnorm,idist,tmpdist;
-			ublas_vec_type diff;
-
-			i = 0;
-			n = (int)subsums.size() ;
-			tmpnorm = std::sqrt( inner_prod(tmpv, tmpv) );
-
-			// i=ClosestNorm(tmpnorm,norms,0,n-1);
-			// for efficiency, replace recursion by iteration
-			start=0;
-			end=n-1;
-			while(start<end)
+			while( !node->IsLeaf() )
 			{
-				if (end-start==1)
-				{
-					float_type norm_end = subsums[end].norm;
-					float_type norm_start = subsums[start].norm;
+				const CFEntry* begin = node->entries;
+				const CFEntry* end = begin + node->size;
+				node = std::min_element( begin, end, CloseEntryLessThan(e, dist_func) )->child;
+			}
 
-					i = tmpnorm > norm_end ? end :
-						tmpnorm < norm_start ? start :
-						tmpnorm - norm_start < norm_end - tmpnorm ? start : end;
-					start = end = i;
+			// leaves of an incremental rebuild whose entries all moved aren't listed
+			typename boost::unordered_map<const CFNode*, std::pair<std::size_t, std::size_t> >::const_iterator it = leaf_offsets.find( node );
+			if( it == leaf_offsets.end() )
+				return;
+			std::size_t offset = it->second.first;
+			for( std::size_t i = it->second.second ; i < node->size ; i++ )
+			{
+				float_type d = dist_func( node->entries[i], e );
+				int cid = leaf_cids[offset + i - it->second.second];
+				if( d < c.d_first )
+				{
+					c.d_second = c.d_first;
+					c.cid_second = c.cid_first;
+					c.d_first = d;
+					c.cid_first = cid;
 				}
-				else
+				else if( d < c.d_second )
 				{
-					median = (start+end)/2;
-					float_type norm_med = subsums[median].norm;
-					if (tmpnorm > norm_med)
-						start=median;
-					else
-						end=median;
+					c.d_second = d;
+					c.cid_second = cid;
 				}
 			}
+		}
 
-			diff = tmpv - subsums[i].center;
-			idist= inner_prod(diff, diff);
-
-			// imin=MinLargerThan(tmpnorm-sqrt(idist),norms,0,n-1);
-			// imax=MaxSmallerThan(tmpnorm+sqrt(idist),norms,0,n-1);
-			// for efficiency, replace recursion by iteration
+		struct _dist_mat_body
+		{
+			_dist_mat_body( redist_index& in_index ) : index(in_index) {}
 
-			tmpdist=tmpnorm-sqrt(idist);
-			start=0;
-			end=n-1;
-			while (start<end)
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
 			{
-				median=(start+end)/2;
-				float_type norm_med = subsums[median].norm;
-				if (tmpdist > norm_med)
-					start=median+1;
-				else
-					end=median;
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+				{
+					for( std::size_t j = 0 ; j <= i ; j++ )
+						index.dist_mat[ i*(i+1)/2 + j ] = euclidean_intrinsic_double( dim, index.center(i), index.center(j), 1.0, 1.0 );
+				}
 			}
-			imin=start;
 
-			tmpdist=tmpnorm+sqrt(idist);
-			start=0;
-			end=n-1;
-			while(start<end)
+			redist_index& index;
+		};
+
+		/** row accessor of a random access range of items */
+		template<typename _iter>
+		struct _iter_rows
+		{
+			_iter_rows( _iter in_begin ) : begin(in_begin) {}
+			const float_type* operator()( std::size_t i ) const { return &begin[i][0]; }
+
+			_iter begin;
+		};
+
+		template<typename rows_type, typename cid_type>
+		struct _redist_body
+		{
+			_redist_body( const redist_index& in_index, const rows_type& in_rows, cid_type* in_cids ) : index(in_index), rows(in_rows), cids(in_cids) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
 			{
-				median=(start+end+1)/2;
-				float_type norm_med = subsums[median].norm;
-				if (tmpdist < norm_med)
-					end=median-1;
-				else
-					start=median;
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+					cids[i] = index.query( rows(i) );
 			}
-			imax=start;
 
-			// ClosestCenter(i,idist,tmpv,centers,imin,imax,matrix,n);
-			// for efficiency, replace procedure by inline
-			k=imin;
-			while (k<=imax)
+			const redist_index&	index;
+			rows_type			rows;
+			cid_type*			cids;
+		};
+
+		template<typename T>
+		struct _route_body
+		{
+			_route_body( const CFTree& in_tree, const basic_matrix_view<T>& in_items, boost::int32_t* in_cids, float_type in_fallback_margin )
+				: tree(in_tree), items(in_items), cids(in_cids), fallback_margin(in_fallback_margin) {}
+
+			void operator()( const tbb::blocked_range<std::size_t>& r ) const
 			{
-				if (dist_mat(k,i) <= 4*idist)
-				{
-					diff = tmpv - subsums[k].center;
-					d = inner_prod(diff,diff);
-					if (d < idist)
-					{
-						idist=d;
-						i=k;
-					}
-				}
-				k++;
+				for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+					cids[i] = tree.route( items[i], fallback_margin );
 			}
-			return i;
-		}
+
+			const CFTree&			tree;
+			basic_matrix_view<T>	items;
+			boost::int32_t*			cids;
+			float_type				fallback_margin;
+		};
+
 // }
 
 #endif
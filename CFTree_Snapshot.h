@@ -0,0 +1,744 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+#ifndef __CFTREE_SNAPSHOT_H__
+#define __CFTREE_SNAPSHOT_H__
+
+/************************************************************************/
+/* a partial class of CFTree, saving and restoring a built tree
+/************************************************************************/
+
+// class CFTree
+// {
+
+	public:
+		/** this exception is produced when a snapshot cannot be written or read. */
+		struct CFTreeSnapshotError : public std::runtime_error
+		{
+			CFTreeSnapshotError( const std::string& what ) : std::runtime_error(what) {}
+		};
+
+		enum { snapshot_version = 2 };
+		enum { snapshot_node_entries = sizeof(CFNode::entries) / sizeof(CFEntry) }; /** entries of a node record, as many as a CFNode holds */
+
+		/** CFEntry of a snapshot, the child is a node id */
+		struct snapshot_entry
+		{
+			boost::uint64_t	n;
+			boost::uint64_t	handle;
+			boost::uint64_t	child;		/** id of the child node, 0 for none */
+			float_type		sum_sq;
+			float_type		sum[dim];
+		};
+
+		/** fixed-size node record, node ids are record positions in the file.
+		 *
+		 * the root is always node 0, which can't be a child or a neighbor leaf, so 0 also stands for no node.
+		 */
+		struct snapshot_node
+		{
+			boost::uint32_t	is_leaf;
+			boost::uint32_t	size;
+			boost::uint64_t	prev;		/** id of the previous leaf, 0 for none */
+			boost::uint64_t	next;		/** id of the next leaf, 0 for none */
+			float_type		threshold;	/** absorption threshold of the node, see CFNode::threshold */
+			snapshot_entry	entries[snapshot_node_entries];
+		};
+
+		/** snapshot file header, followed by node_count node records and handle_count handle parents */
+		struct snapshot_header
+		{
+			char			magic[8];		/** "CFTREE\0\0" */
+			boost::uint32_t	version;
+			boost::uint32_t	item_dim;
+			boost::uint32_t	node_entries;
+			boost::uint32_t	node_size;		/** sizeof(snapshot_node) */
+			boost::uint64_t	node_count;
+			boost::uint64_t	first_leaf;
+			boost::uint64_t	handle_count;
+			boost::uint64_t	k_limit;
+			float_type		dist_threshold;
+			boost::uint32_t	rebuild_interval;
+			boost::uint32_t	rebuild_pos;
+			boost::int32_t	dist_func;		/** index of _DistD0.._DistD3, -1 for another function */
+			boost::int32_t	absorb_dist_func;
+			boost::uint32_t	handles_tracked;
+			boost::uint32_t	generation;		/** checkpoint generation, deltas of other generations don't apply */
+		};
+
+		/** header of a delta of a checkpoint log.
+		 *
+		 * a delta is the header, node_count (id, node record) pairs, handle_updates (handle, parent) pairs
+		 * and seq again, bytes in all. a torn delta at the end of the log is ignored.
+		 */
+		struct snapshot_delta_header
+		{
+			char			magic[8];		/** "CFDELTA\0" */
+			boost::uint64_t	bytes;
+			boost::uint64_t	seq;			/** 1 for the first delta after the base */
+			boost::uint32_t	generation;
+			boost::uint32_t	handles_tracked;
+			boost::uint64_t	root;
+			boost::uint64_t	first_leaf;
+			boost::uint64_t	next_node_id;
+			boost::uint64_t	node_count;
+			boost::uint64_t	handle_count;	/** # handles of the tree */
+			boost::uint64_t	handle_updates;
+			boost::uint64_t	k_limit;
+			float_type		dist_threshold;
+			boost::uint32_t	rebuild_interval;
+			boost::uint32_t	rebuild_pos;
+			boost::int32_t	dist_func;
+			boost::int32_t	absorb_dist_func;
+		};
+
+		/** node record of a delta */
+		struct snapshot_delta_node
+		{
+			boost::uint64_t	id;
+			snapshot_node	node;
+		};
+
+		/** read-only snapshot mapped in memory.
+		 *
+		 * node records are used in place, so reading leaf entries or walking nodes costs nothing up front.
+		 */
+		class snapshot_view
+		{
+		public:
+			snapshot_view( const char* path ) : file(path)
+			{
+				if( file.size() < sizeof(snapshot_header) )
+					throw CFTreeSnapshotError( std::string("truncated snapshot ") + path );
+
+				const snapshot_header& h = header();
+				if( std::memcmp( h.magic, "CFTREE\0\0", sizeof(h.magic) ) != 0 || h.version != snapshot_version )
+					throw CFTreeSnapshotError( std::string("not a CFTree snapshot ") + path );
+				if( h.item_dim != dim || h.node_entries != snapshot_node_entries || h.node_size != sizeof(snapshot_node) )
+					throw CFTreeSnapshotError( std::string("snapshot of another CFTree type ") + path );
+				// counts checked by division, so that huge ones can't wrap around
+				std::size_t body = file.size() - sizeof(snapshot_header);
+				if( h.node_count == 0 || h.node_count > body / sizeof(snapshot_node) || h.handle_count > ( body - h.node_count * sizeof(snapshot_node) ) / sizeof(boost::uint64_t) )
+					throw CFTreeSnapshotError( std::string("truncated snapshot ") + path );
+			}
+
+			const snapshot_header& header() const { return *(const snapshot_header*)file.data(); }
+			std::size_t node_count() const { return (std::size_t)header().node_count; }
+			const snapshot_node& node( std::size_t id ) const { return ((const snapshot_node*)(file.data() + sizeof(snapshot_header)))[id]; }
+			const snapshot_node& root() const { return node(0); }
+			const boost::uint64_t* handle_parents() const { return (const boost::uint64_t*)(file.data() + sizeof(snapshot_header) + node_count() * sizeof(snapshot_node)); }
+
+			/** leaf entries in the leaf chain order, like CFTree::get_entries() */
+			void get_entries( cfentry_vec_type& out_entries ) const
+			{
+				out_entries.clear();
+				if( root().size == 0 )
+					return;
+				for( boost::uint64_t id = header().first_leaf, n_leaves = 0 ; ; )
+				{
+					if( id >= node_count() || ++n_leaves > node_count() || node( (std::size_t)id ).size > snapshot_node_entries )
+						throw CFTreeSnapshotError( "corrupt snapshot, broken leaf chain" );
+					const snapshot_node& leaf = node( (std::size_t)id );
+					for( std::size_t i = 0 ; i < leaf.size ; i++ )
+					{
+						out_entries.push_back( CFEntry() );
+						_copy_entry( leaf.entries[i], out_entries.back() );
+					}
+					if( leaf.next == 0 )
+						break;
+					id = leaf.next;
+				}
+			}
+
+		private:
+			mapped_file file;
+		};
+
+		/** writing the tree to path, nodes numbered breadth first from the root */
+		void save( const char* path )
+		{
+			finish_rebuild();
+
+			// number nodes, so that children and leaf links can be written as ids
+			std::vector<CFNode*> order;
+			_bfs_order( order );
+			boost::unordered_map<const CFNode*, boost::uint64_t> ids;
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+				ids[order[i]] = i;
+
+			snapshot_header h;
+			std::memset( &h, 0, sizeof(h) );
+			std::memcpy( h.magic, "CFTREE\0\0", sizeof(h.magic) );
+			h.version = snapshot_version;
+			h.item_dim = dim;
+			h.node_entries = snapshot_node_entries;
+			h.node_size = sizeof(snapshot_node);
+			h.node_count = order.size();
+			h.first_leaf = ids[((CFNodeLeaf*)leaf_dummy)->next];
+			h.handle_count = handle_parent.size();
+			h.k_limit = k_limit;
+			h.dist_threshold = dist_threshold;
+			h.rebuild_interval = rebuild_interval;
+			h.rebuild_pos = rebuild_pos;
+			h.dist_func = _dist_func_id( dist_func );
+			h.absorb_dist_func = _dist_func_id( absorb_dist_func );
+			h.handles_tracked = handles_tracked;
+			h.generation = checkpoint_generation;
+
+			std::FILE* fp = std::fopen( path, "wb" );
+			if( fp == NULL )
+				throw CFTreeSnapshotError( std::string("cannot open ") + path );
+			std::vector<char> buffer( 4*1024*1024 );
+			std::setvbuf( fp, &buffer[0], _IOFBF, buffer.size() );
+
+			bool ok = std::fwrite( &h, sizeof(h), 1, fp ) == 1;
+
+			snapshot_node record;
+			for( std::size_t i = 0 ; ok && i < order.size() ; i++ )
+			{
+				_fill_record( order[i], record, &ids );
+				ok = std::fwrite( &record, sizeof(record), 1, fp ) == 1;
+			}
+
+			for( std::size_t i = 0 ; ok && i < handle_parent.size() ; i++ )
+			{
+				boost::uint64_t parent = handle_parent[i];
+				ok = std::fwrite( &parent, sizeof(parent), 1, fp ) == 1;
+			}
+
+			ok = ok && sync_file( fp );
+			if( std::fclose( fp ) != 0 || !ok )
+				throw CFTreeSnapshotError( std::string("cannot write ") + path );
+		}
+
+		/** replacing this tree by the one saved in path */
+		void load( const char* path )
+		{
+			snapshot_view view( path );
+			load( view );
+		}
+
+		/** replacing this tree by a copy of a mapped snapshot, the only work being to turn ids back into pointers.
+		 *
+		 * distance functions other than _DistD0.._DistD3 can't be saved, this tree keeps its own in that case.
+		 */
+		void load( const snapshot_view& view )
+		{
+			const snapshot_header& h = view.header();
+
+			std::vector<const snapshot_node*> records( view.node_count() );
+			for( std::size_t i = 0 ; i < records.size() ; i++ )
+				records[i] = &view.node(i);
+			const boost::uint64_t* parents = view.handle_parents();
+			for( std::size_t i = 0 ; i < h.handle_count ; i++ )
+				if( parents[i] >= h.handle_count )
+					throw CFTreeSnapshotError( "corrupt snapshot, bad handle parent" );
+			_materialize( records, 0, h.first_leaf, (std::size_t)h.handle_count );
+
+			k_limit = (std::size_t)h.k_limit;
+			dist_threshold = h.dist_threshold;
+			rebuild_interval = h.rebuild_interval;
+			rebuild_pos = h.rebuild_pos;
+			if( h.dist_func >= 0 )
+				dist_func = _dist_func_by_id( h.dist_func );
+			if( h.absorb_dist_func >= 0 )
+				absorb_dist_func = _dist_func_by_id( h.absorb_dist_func );
+			handles_tracked = h.handles_tracked != 0;
+			inserted_handle = (handle_type)invalid_handle;
+			handle_parent.assign( parents, parents + h.handle_count );
+
+			next_node_id = records.size();
+			dirty_tracked = false;
+			handles_checkpointed = handle_parent.size();
+			checkpoint_generation = h.generation;
+			checkpoint_seq = 0;
+		}
+
+		/** writing a base checkpoint and starting an empty log.
+		 *
+		 * the snapshot is written aside and renamed over base_path, so a crash leaves either checkpoint whole.
+		 * from now on, the tree lists the nodes it changes for checkpoint_delta().
+		 */
+		void checkpoint_base( const char* base_path, const char* log_path )
+		{
+			finish_rebuild();
+
+			// ids become breadth first positions, as in the snapshot
+			std::vector<CFNode*> order;
+			_bfs_order( order );
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+			{
+				order[i]->id = i;
+				order[i]->dirty = false;
+			}
+			next_node_id = order.size();
+			_clear_dirty_nodes();
+			dirty_handles.clear();
+			handles_checkpointed = handle_parent.size();
+			dirty_tracked = true;
+
+			// a new generation, so that deltas of the previous log can't apply to the new base
+			checkpoint_generation = (std::max)( (boost::uint32_t)time(NULL), checkpoint_generation + 1 );
+			checkpoint_seq = 0;
+
+			std::string tmp_path = std::string(base_path) + ".tmp";
+			save( tmp_path.c_str() );
+			std::error_code ec;
+			std::filesystem::rename( tmp_path, base_path, ec );
+			if( ec )
+				throw CFTreeSnapshotError( std::string("cannot replace ") + base_path );
+
+			std::FILE* fp = std::fopen( log_path, "wb" );
+			bool ok = fp != NULL && sync_file( fp );
+			if( fp == NULL || std::fclose( fp ) != 0 || !ok )
+				throw CFTreeSnapshotError( std::string("cannot write ") + log_path );
+
+			checkpoint_base_bytes = (std::size_t)std::filesystem::file_size( base_path );
+			checkpoint_log_bytes = 0;
+		}
+
+		/** appending the nodes and handles changed since the last checkpoint to log_path.
+		 *
+		 * an insertion changes one path from the root to a leaf, so deltas stay small compared with the tree.
+		 *
+		 * @return	the number of node records written
+		 */
+		std::size_t checkpoint_delta( const char* log_path )
+		{
+			finish_rebuild();
+
+			if( !dirty_tracked )
+				throw CFTreeSnapshotError( "no base checkpoint to append a delta to" );
+
+			std::vector<CFNode*> changed;
+			for( std::size_t i = 0 ; i < dirty_nodes.size() ; i++ )
+				if( dirty_nodes[i]->dirty )
+					changed.push_back( dirty_nodes[i] );
+
+			std::vector<boost::uint64_t> updates;
+			for( std::size_t i = 0 ; i < dirty_handles.size() ; i++ )
+			{
+				updates.push_back( dirty_handles[i] );
+				updates.push_back( handle_parent[dirty_handles[i]] );
+			}
+			for( std::size_t h = handles_checkpointed ; h < handle_parent.size() ; h++ )
+			{
+				updates.push_back( h );
+				updates.push_back( handle_parent[h] );
+			}
+
+			snapshot_delta_header h;
+			std::memset( &h, 0, sizeof(h) );
+			std::memcpy( h.magic, "CFDELTA\0", sizeof(h.magic) );
+			h.bytes = sizeof(h) + changed.size() * sizeof(snapshot_delta_node) + updates.size() * sizeof(boost::uint64_t) + sizeof(boost::uint64_t);
+			h.seq = checkpoint_seq + 1;
+			h.generation = checkpoint_generation;
+			h.handles_tracked = handles_tracked;
+			h.root = root->id;
+			h.first_leaf = ((CFNodeLeaf*)leaf_dummy)->next->id;
+			h.next_node_id = next_node_id;
+			h.node_count = changed.size();
+			h.handle_count = handle_parent.size();
+			h.handle_updates = updates.size() / 2;
+			h.k_limit = k_limit;
+			h.dist_threshold = dist_threshold;
+			h.rebuild_interval = rebuild_interval;
+			h.rebuild_pos = rebuild_pos;
+			h.dist_func = _dist_func_id( dist_func );
+			h.absorb_dist_func = _dist_func_id( absorb_dist_func );
+
+			std::FILE* fp = std::fopen( log_path, "ab" );
+			if( fp == NULL )
+				throw CFTreeSnapshotError( std::string("cannot open ") + log_path );
+			std::vector<char> buffer( 4*1024*1024 );
+			std::setvbuf( fp, &buffer[0], _IOFBF, buffer.size() );
+
+			bool ok = std::fwrite( &h, sizeof(h), 1, fp ) == 1;
+			snapshot_delta_node record;
+			for( std::size_t i = 0 ; ok && i < changed.size() ; i++ )
+			{
+				record.id = changed[i]->id;
+				_fill_record( changed[i], record.node, NULL );
+				ok = std::fwrite( &record, sizeof(record), 1, fp ) == 1;
+			}
+			ok = ok && ( updates.empty() || std::fwrite( &updates[0], sizeof(boost::uint64_t), updates.size(), fp ) == updates.size() );
+			ok = ok && std::fwrite( &h.seq, sizeof(h.seq), 1, fp ) == 1;
+			ok = ok && sync_file( fp );
+			if( std::fclose( fp ) != 0 || !ok )
+				throw CFTreeSnapshotError( std::string("cannot write ") + log_path );
+
+			for( std::size_t i = 0 ; i < changed.size() ; i++ )
+				changed[i]->dirty = false;
+			_clear_dirty_nodes();
+			dirty_handles.clear();
+			handles_checkpointed = handle_parent.size();
+			checkpoint_seq = h.seq;
+			checkpoint_log_bytes += (std::size_t)h.bytes;
+
+			return changed.size();
+		}
+
+		/** a delta, or a new base once the log outgrows compact_ratio times the base */
+		void checkpoint( const char* base_path, const char* log_path, double compact_ratio = 1.0 )
+		{
+			if( !dirty_tracked || checkpoint_log_bytes > compact_ratio * checkpoint_base_bytes )
+				checkpoint_base( base_path, log_path );
+			else
+				checkpoint_delta( log_path );
+		}
+
+		/** replacing this tree by the base checkpoint and the deltas of the log replayed over it.
+		 *
+		 * a torn delta at the end of the log, left by a crash, is cut off so that later deltas follow the last good one.
+		 * so is a delta naming node records or handles which neither the base nor the deltas before it have.
+		 *
+		 * @return	the number of deltas replayed
+		 */
+		std::size_t recover( const char* base_path, const char* log_path )
+		{
+			snapshot_view base( base_path );
+			const snapshot_header& bh = base.header();
+
+			std::vector<const snapshot_node*> records( base.node_count() );
+			for( std::size_t i = 0 ; i < records.size() ; i++ )
+				records[i] = &base.node(i);
+			std::vector<handle_type> parents( base.handle_parents(), base.handle_parents() + bh.handle_count );
+			for( std::size_t i = 0 ; i < parents.size() ; i++ )
+				if( parents[i] >= parents.size() )
+					throw CFTreeSnapshotError( std::string("corrupt snapshot, bad handle parent ") + base_path );
+
+			// the base's state, unless a delta brings a newer one
+			snapshot_delta_header state;
+			std::memset( &state, 0, sizeof(state) );
+			state.root = 0;
+			state.first_leaf = bh.first_leaf;
+			state.next_node_id = records.size();
+			state.handles_tracked = bh.handles_tracked;
+			state.k_limit = bh.k_limit;
+			state.dist_threshold = bh.dist_threshold;
+			state.rebuild_interval = bh.rebuild_interval;
+			state.rebuild_pos = bh.rebuild_pos;
+			state.dist_func = bh.dist_func;
+			state.absorb_dist_func = bh.absorb_dist_func;
+
+			std::error_code ec;
+			std::size_t log_size = std::filesystem::exists( log_path, ec ) ? (std::size_t)std::filesystem::file_size( log_path, ec ) : 0;
+			std::unique_ptr<mapped_file> log( log_size > 0 ? new mapped_file( log_path ) : NULL );
+
+			std::size_t pos = 0;
+			std::size_t n_deltas = 0;
+			while( pos + sizeof(snapshot_delta_header) <= log_size )
+			{
+				const char* p = log->data() + pos;
+				const snapshot_delta_header& h = *(const snapshot_delta_header*)p;
+				if( std::memcmp( h.magic, "CFDELTA\0", sizeof(h.magic) ) != 0 || h.generation != bh.generation || h.seq != state.seq + 1 ||
+					h.bytes > log_size - pos || h.node_count > h.bytes / sizeof(snapshot_delta_node) || h.handle_updates > h.bytes / ( 2 * sizeof(boost::uint64_t) ) ||
+					h.bytes != sizeof(h) + h.node_count * sizeof(snapshot_delta_node) + 2 * h.handle_updates * sizeof(boost::uint64_t) + sizeof(boost::uint64_t) ||
+					*(const boost::uint64_t*)(p + h.bytes - sizeof(boost::uint64_t)) != h.seq )
+					break;
+
+				// a delta naming missing records or handles is dropped like a torn one, with the ones after it
+				const snapshot_delta_node* nodes_in = (const snapshot_delta_node*)(p + sizeof(h));
+				const boost::uint64_t* updates = (const boost::uint64_t*)(nodes_in + h.node_count);
+				if( !_valid_handle_updates( h, updates, parents.size() ) )
+					break;
+				std::size_t n_records = records.size();
+				std::vector< std::pair<std::size_t, const snapshot_node*> > replaced;
+				for( std::size_t i = 0 ; i < h.node_count ; i++ )
+				{
+					std::size_t id = (std::size_t)nodes_in[i].id;
+					if( id >= h.next_node_id )
+						break;
+					if( id >= records.size() )
+						records.resize( id + 1, NULL );
+					replaced.push_back( std::make_pair( id, records[id] ) );
+					records[id] = &nodes_in[i].node;
+				}
+				if( replaced.size() != h.node_count || !_valid_delta_refs( records, h, nodes_in ) )
+				{
+					for( std::size_t i = replaced.size() ; i-- > 0 ; )
+						records[replaced[i].first] = replaced[i].second;
+					records.resize( n_records );
+					break;
+				}
+
+				parents.resize( (std::size_t)h.handle_count );
+				for( std::size_t i = 0 ; i < h.handle_updates ; i++ )
+					parents[(std::size_t)updates[2 * i]] = (handle_type)updates[2 * i + 1];
+
+				state = h;
+				pos += (std::size_t)h.bytes;
+				n_deltas++;
+			}
+
+			_materialize( records, state.root, state.first_leaf, parents.size() );
+
+			k_limit = (std::size_t)state.k_limit;
+			dist_threshold = state.dist_threshold;
+			rebuild_interval = state.rebuild_interval;
+			rebuild_pos = state.rebuild_pos;
+			if( state.dist_func >= 0 )
+				dist_func = _dist_func_by_id( state.dist_func );
+			if( state.absorb_dist_func >= 0 )
+				absorb_dist_func = _dist_func_by_id( state.absorb_dist_func );
+			handles_tracked = state.handles_tracked != 0;
+			inserted_handle = (handle_type)invalid_handle;
+			handle_parent.swap( parents );
+
+			next_node_id = (std::size_t)state.next_node_id;
+			dirty_tracked = true;
+			handles_checkpointed = handle_parent.size();
+			checkpoint_generation = bh.generation;
+			checkpoint_seq = state.seq;
+
+			// cutting a torn tail off, the mapping has to go first
+			log.reset();
+			if( pos < log_size )
+			{
+				std::filesystem::resize_file( log_path, pos, ec );
+				if( ec )
+					throw CFTreeSnapshotError( std::string("cannot truncate ") + log_path );
+			}
+			checkpoint_base_bytes = (std::size_t)std::filesystem::file_size( base_path );
+			checkpoint_log_bytes = pos;
+
+			return n_deltas;
+		}
+
+	private:
+		/** record id names a record, 0 standing for none if optional */
+		static bool _valid_ref( const std::vector<const snapshot_node*>& records, boost::uint64_t id, bool optional )
+		{
+			if( id == 0 )
+				return optional;
+			return id < records.size() && records[(std::size_t)id] != NULL;
+		}
+
+		/** the nodes of a delta, once replayed, and the root and first leaf name existing records */
+		static bool _valid_delta_refs( const std::vector<const snapshot_node*>& records, const snapshot_delta_header& h, const snapshot_delta_node* nodes_in )
+		{
+			if( h.root >= records.size() || records[(std::size_t)h.root] == NULL || h.first_leaf >= records.size() || records[(std::size_t)h.first_leaf] == NULL )
+				return false;
+			for( std::size_t i = 0 ; i < h.node_count ; i++ )
+			{
+				const snapshot_node& record = nodes_in[i].node;
+				if( record.size > snapshot_node_entries || !_valid_ref( records, record.prev, true ) || !_valid_ref( records, record.next, true ) )
+					return false;
+				for( std::size_t j = 0 ; j < record.size ; j++ )
+					if( !_valid_ref( records, record.entries[j].child, record.is_leaf != 0 ) )
+						return false;
+			}
+			return true;
+		}
+
+		/** a delta's handles only grow, each new one coming with its parent, and updates stay among them */
+		static bool _valid_handle_updates( const snapshot_delta_header& h, const boost::uint64_t* updates, std::size_t n_handles )
+		{
+			if( h.handle_count < n_handles || h.handle_count - n_handles > h.handle_updates )
+				return false;
+			for( std::size_t i = 0 ; i < 2 * h.handle_updates ; i++ )
+				if( updates[i] >= h.handle_count )
+					return false;
+			return true;
+		}
+
+		/** nodes breadth first from the root, the order of snapshot records */
+		void _bfs_order( std::vector<CFNode*>& order ) const
+		{
+			order.clear();
+			order.push_back( root );
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+			{
+				const CFNode* node = order[i];
+				if( !node->IsLeaf() )
+					for( std::size_t j = 0 ; j < node->size ; j++ )
+						order.push_back( node->entries[j].child );
+			}
+		}
+
+		/** node record of node, nodes being numbered by ids or by their persistent ids if ids is NULL */
+		void _fill_record( const CFNode* node, snapshot_node& record, boost::unordered_map<const CFNode*, boost::uint64_t>* ids ) const
+		{
+			std::memset( &record, 0, sizeof(record) );
+			record.is_leaf = node->IsLeaf();
+			record.size = (boost::uint32_t)node->size;
+			record.threshold = node->threshold;
+			if( node->IsLeaf() )
+			{
+				const CFNodeLeaf* leaf = (const CFNodeLeaf*)node;
+				if( leaf->prev && leaf->prev != leaf_dummy )
+					record.prev = ids ? (*ids)[leaf->prev] : leaf->prev->id;
+				if( leaf->next )
+					record.next = ids ? (*ids)[leaf->next] : leaf->next->id;
+			}
+			for( std::size_t j = 0 ; j < node->size ; j++ )
+			{
+				const CFEntry& e = node->entries[j];
+				snapshot_entry& r = record.entries[j];
+				r.n = e.n;
+				r.handle = e.handle;
+				if( e.child )
+					r.child = ids ? (*ids)[e.child] : e.child->id;
+				r.sum_sq = e.sum_sq;
+				std::copy( e.sum, e.sum + dim, r.sum );
+			}
+		}
+
+		/** records reachable from records[root_id] make a tree: every node is reached once, sizes fit in a node,
+		 * children and leaf links name existing records, and the leaf chain from first_leaf_id goes through every leaf.
+		 */
+		static bool _valid_records( const std::vector<const snapshot_node*>& records, boost::uint64_t root_id, boost::uint64_t first_leaf_id, std::size_t n_handles )
+		{
+			if( root_id >= records.size() || records[(std::size_t)root_id] == NULL )
+				return false;
+
+			std::vector<bool> visited( records.size(), false );
+			std::vector<std::size_t> order( 1, (std::size_t)root_id );
+			visited[(std::size_t)root_id] = true;
+			std::size_t n_leaves = 0;
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+			{
+				const snapshot_node& record = *records[order[i]];
+				if( record.size > snapshot_node_entries || record.is_leaf > 1 || ( !record.is_leaf && record.size == 0 ) )
+					return false;
+				n_leaves += record.is_leaf;
+				for( std::size_t j = 0 ; j < record.size ; j++ )
+				{
+					const snapshot_entry& r = record.entries[j];
+					if( record.is_leaf && r.handle != (boost::uint64_t)(handle_type)invalid_handle && r.handle >= n_handles )
+						return false;
+					if( ( r.child != 0 ) == ( record.is_leaf != 0 ) )
+						return false;
+					if( r.child == 0 )
+						continue;
+					if( r.child >= records.size() || records[(std::size_t)r.child] == NULL || visited[(std::size_t)r.child] )
+						return false;
+					visited[(std::size_t)r.child] = true;
+					order.push_back( (std::size_t)r.child );
+				}
+			}
+
+			// leaves linked both ways, from the first one to the last one
+			boost::uint64_t prev = 0;
+			boost::uint64_t id = first_leaf_id;
+			for( std::size_t k = 0 ; k < n_leaves ; k++ )
+			{
+				if( id >= records.size() || !visited[(std::size_t)id] || !records[(std::size_t)id]->is_leaf || records[(std::size_t)id]->prev != prev )
+					return false;
+				prev = id;
+				id = records[(std::size_t)id]->next;
+			}
+			return id == 0;
+		}
+
+		/** replacing the nodes of this tree by the ones reachable from records[root_id], keeping their ids.
+		 *
+		 * records are checked first, a corrupt snapshot throws CFTreeSnapshotError and leaves the tree as it was.
+		 */
+		void _materialize( const std::vector<const snapshot_node*>& records, boost::uint64_t root_id, boost::uint64_t first_leaf_id, std::size_t n_handles )
+		{
+			if( !_valid_records( records, root_id, first_leaf_id, n_handles ) )
+				throw CFTreeSnapshotError( "corrupt snapshot" );
+
+			_invalidate_leaf_map();
+			clear();
+
+			std::vector<CFNode*> ptrs( records.size(), (CFNode*)NULL );
+			std::vector<std::size_t> order( 1, (std::size_t)root_id );
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+			{
+				std::size_t id = order[i];
+				const snapshot_node& record = *records[id];
+				CFNode* node = record.is_leaf ? (CFNode*)new CFNodeLeaf() : (CFNode*)new CFNodeItmd();
+				// checked already, the bound lets the compiler see that the copies stay in the node
+				const std::size_t size = (std::min)( (std::size_t)record.size, (std::size_t)snapshot_node_entries );
+				node->id = id;
+				node->size = size;
+				node->threshold = record.threshold;
+				for( std::size_t j = 0 ; j < size ; j++ )
+				{
+					_copy_entry( record.entries[j], node->entries[j] );
+					if( record.entries[j].child )
+						order.push_back( (std::size_t)record.entries[j].child );
+				}
+				ptrs[id] = node;
+			}
+
+			for( std::size_t i = 0 ; i < order.size() ; i++ )
+			{
+				const snapshot_node& record = *records[order[i]];
+				CFNode* node = ptrs[order[i]];
+				for( std::size_t j = 0 ; j < record.size ; j++ )
+					node->entries[j].child = record.entries[j].child ? ptrs[(std::size_t)record.entries[j].child] : NULL;
+				if( record.is_leaf )
+				{
+					((CFNodeLeaf*)node)->prev = record.prev ? ptrs[(std::size_t)record.prev] : NULL;
+					((CFNodeLeaf*)node)->next = record.next ? ptrs[(std::size_t)record.next] : NULL;
+				}
+			}
+
+			// the root is kept apart from the other nodes, as the constructor does
+			root = ptrs[(std::size_t)root_id];
+			nodes = new cfnode_ptr_vec_type();
+			nodes->reserve( order.size() - 1 );
+			for( std::size_t i = 1 ; i < order.size() ; i++ )
+				_add_node( ptrs[order[i]] );
+			leaf_dummy = new CFNodeLeaf();
+			CFNodeLeaf* first_leaf = (CFNodeLeaf*)ptrs[(std::size_t)first_leaf_id];
+			((CFNodeLeaf*)leaf_dummy)->next = first_leaf;
+			if( first_leaf != root )
+				first_leaf->prev = leaf_dummy;
+			node_cnt = order.size();
+
+			_clear_dirty_nodes();
+			dirty_handles.clear();
+		}
+
+		static void _copy_entry( const snapshot_entry& r, CFEntry& e )
+		{
+			e.n = (std::size_t)r.n;
+			e.handle = (handle_type)r.handle;
+			e.sum_sq = r.sum_sq;
+			std::copy( r.sum, r.sum + dim, e.sum );
+		}
+
+		static boost::int32_t _dist_func_id( dist_func_type f )
+		{
+			dist_func_type funcs[] = { _DistD0, _DistD1, _DistD2, _DistD3 };
+			for( boost::int32_t i = 0 ; i < (boost::int32_t)ARRAY_COUNT(funcs) ; i++ )
+				if( funcs[i] == f )
+					return i;
+			return -1;
+		}
+
+		static dist_func_type _dist_func_by_id( boost::int32_t id )
+		{
+			dist_func_type funcs[] = { _DistD0, _DistD1, _DistD2, _DistD3 };
+			return id < (boost::int32_t)ARRAY_COUNT(funcs) ? funcs[id] : _DistD0;
+		}
+
+		// checkpoint files
+		boost::uint32_t	checkpoint_generation;	/* generation of the base checkpoint */
+		boost::uint64_t	checkpoint_seq;			/* seq of the last delta */
+		std::size_t		checkpoint_base_bytes;
+		std::size_t		checkpoint_log_bytes;
+
+// };
+
+#endif
@@ -0,0 +1,635 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+/** C interface of the birch library, see birch_api.h.
+ *
+ * The calling program may run with floating point exceptions unmasked;
+ * every entry point masks them while it runs and restores the caller's environment on return.
+ */
+
+#define BIRCH_EXPORTS
+#include "birch_api.h"
+
+#include "CFTree.h"
+
+#if defined(_WIN32)
+	#include <float.h>
+
+	#define API_FP_PRE() \
+		unsigned int _cFP; \
+		_controlfp_s(&_cFP, 0, 0); \
+		_set_controlfp(0x1f, 0x1f);
+
+	#define API_FP_POST() \
+		_set_controlfp(_cFP, 0x1f); \
+		_clearfp();
+#else
+	#include <cfenv>
+
+	#define API_FP_PRE() \
+		std::fenv_t _cFP; \
+		std::feholdexcept(&_cFP);
+
+	#define API_FP_POST() \
+		std::fesetenv(&_cFP); \
+		std::feclearexcept(FE_ALL_EXCEPT);
+#endif
+
+typedef CFTree<BIRCH_DIM> cftree_type;
+
+extern "C"
+{
+	class api_ptr_t {
+		public:
+			cftree_type::cfentry_vec_type entries;
+			cftree_type::redist_index index; /* redistribution index of entries */
+			cftree_type* tree;
+			cftree_type::minibatch_kmeans* minibatch;
+
+			api_ptr_t(void) : tree(NULL), minibatch(NULL) {};
+	};
+
+	DLL_API void* BIRCH_CALL birch_create(float dist_threshold, uint64_t k_limit, uint32_t rebuild_interval)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = new api_ptr_t();
+		ab->tree = new cftree_type(dist_threshold, k_limit, rebuild_interval);
+
+		API_FP_POST();
+
+		return ab;
+	}
+
+	DLL_API void BIRCH_CALL birch_destroy(void* birch)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		delete ab->minibatch;
+		delete ab->tree;
+		delete ab;
+
+		API_FP_POST();
+	}
+
+	DLL_API bool BIRCH_CALL birch_save(void* birch, const char* path)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		bool ok = true;
+		try
+		{
+			ab->tree->save(path);
+		}
+		catch (const std::exception&)
+		{
+			ok = false;
+		}
+
+		API_FP_POST();
+
+		return ok;
+	}
+
+	DLL_API bool BIRCH_CALL birch_load(void* birch, const char* path)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		bool ok = true;
+		try
+		{
+			ab->tree->load(path);
+		}
+		catch (const std::exception&)
+		{
+			ok = false;
+		}
+
+		API_FP_POST();
+
+		return ok;
+	}
+
+	DLL_API bool BIRCH_CALL birch_checkpoint(void* birch, const char* base_path, const char* log_path, double compact_ratio)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		bool ok = true;
+		try
+		{
+			ab->tree->checkpoint(base_path, log_path, compact_ratio);
+		}
+		catch (const std::exception&)
+		{
+			ok = false;
+		}
+
+		API_FP_POST();
+
+		return ok;
+	}
+
+	DLL_API int64_t BIRCH_CALL birch_recover(void* birch, const char* base_path, const char* log_path)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		int64_t n_deltas;
+		try
+		{
+			n_deltas = (int64_t)ab->tree->recover(base_path, log_path);
+		}
+		catch (const std::exception&)
+		{
+			n_deltas = -1;
+		}
+
+		API_FP_POST();
+
+		return n_deltas;
+	}
+
+	DLL_API bool BIRCH_CALL birch_merge(void* birch, void* other)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+		api_ptr_t* ob = (api_ptr_t*) other;
+
+		bool ok = true;
+		try
+		{
+			ob->tree->finish_rebuild();
+			ab->tree->merge(*ob->tree);
+		}
+		catch (const std::exception&)
+		{
+			ok = false;
+		}
+
+		API_FP_POST();
+
+		return ok;
+	}
+
+	DLL_API bool BIRCH_CALL birch_merge_file(void* birch, const char* path)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		bool ok = true;
+		try
+		{
+			ab->tree->merge(cftree_type::snapshot_view(path));
+		}
+		catch (const std::exception&)
+		{
+			ok = false;
+		}
+
+		API_FP_POST();
+
+		return ok;
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_line(void* birch, cftree_type::float_type* line)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert(line);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows(void* birch, const cftree_type::float_type* data, size_t rows, size_t stride)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert_rows(cftree_type::matrix_view(data, rows, stride));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows_f32(void* birch, const float* data, size_t rows, size_t stride)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert_rows(cftree_type::matrix_view_f32(data, rows, stride));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows_i16(void* birch, const int16_t* data, size_t rows, size_t stride)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert_rows(cftree_type::matrix_view_i16(data, rows, stride));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows_i8(void* birch, const int8_t* data, size_t rows, size_t stride)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert_rows(cftree_type::matrix_view_i8(data, rows, stride));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows_u8(void* birch, const uint8_t* data, size_t rows, size_t stride)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->insert_rows(cftree_type::matrix_view_u8(data, rows, stride));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_track_handles(void* birch, bool track)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->track_handles(track);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_background_rebuild(void* birch, bool enable)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->rebuild_in_background(enable);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_incremental_rebuild(void* birch, size_t budget)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->rebuild_incrementally(budget);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_bulk_rebuild(void* birch, bool enable)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->rebuild_in_bulk(enable);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_partial_rebuild(void* birch, bool enable)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->rebuild_partially(enable);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_rebuild_target(void* birch, double fill)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->rebuild_target((cftree_type::float_type)fill);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_rebuild_stats(void* birch, uint64_t* overflows, uint64_t* rebuilds)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		const cftree_type::rebuild_stats& stats = ab->tree->get_rebuild_stats();
+		*overflows = stats.overflows;
+		*rebuilds = stats.rebuilds;
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_warm_up(void* birch, size_t n_points)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->warm_up(n_points);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_merge_on_overflow(void* birch, double bound, bool diameter)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->merge_on_overflow((cftree_type::float_type)bound, diameter);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_merging_refinement(void* birch, bool enable)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->merging_refinement(enable);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_occupancy(void* birch, uint64_t* nodes, double* fill, double* leaf_fill)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		ab->tree->finish_rebuild();
+		cftree_type::occupancy_stats occ = ab->tree->get_occupancy_stats();
+		*nodes = occ.nodes;
+		*fill = occ.fill();
+		*leaf_fill = occ.leaf_fill();
+
+		API_FP_POST();
+	}
+
+	DLL_API uint64_t BIRCH_CALL birch_insert_line_handle(void* birch, cftree_type::float_type* line)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		uint64_t handle = ab->tree->insert(line);
+
+		API_FP_POST();
+
+		return handle;
+	}
+
+	DLL_API void BIRCH_CALL birch_insert_rows_handles(void* birch, const cftree_type::float_type* data, size_t rows, size_t stride, uint64_t* handles)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		std::vector<cftree_type::handle_type> item_handles(rows);
+		ab->tree->insert_rows(cftree_type::matrix_view(data, rows, stride), rows ? &item_handles[0] : NULL);
+		std::copy(item_handles.begin(), item_handles.end(), handles);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_resolve_handles(void* birch, const uint64_t* handles, size_t count, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		for (std::size_t i = 0; i < count; i++)
+			pointToCluster[i] = ab->tree->resolve_handle((cftree_type::handle_type)handles[i]);
+
+		API_FP_POST();
+	}
+
+	DLL_API size_t BIRCH_CALL birch_compute(void* birch, bool extend, bool cluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->rebuild(extend);
+
+		if (cluster)
+			ab->tree->cluster(ab->entries);
+		else
+			ab->tree->get_entries(ab->entries);
+
+		ab->tree->prepare_redist(ab->entries, ab->index);
+
+		API_FP_POST();
+
+		return ab->entries.size();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_centroids(void * birch, cftree_type::float_type* centroids)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*) birch;
+
+		for (std::size_t i = 0; i < ab->entries.size(); i++)
+		{
+			const cftree_type::CFEntry& e = ab->entries[i];
+			
+			std::copy(e.sum, e.sum + ab->tree->fdim, centroids);
+			
+			cftree_type::float_type inv_n = 1.0 / e.n;
+
+			for (std::size_t j = 0; j < ab->tree->fdim; j++)
+			{
+				centroids[j] *= inv_n;
+			}	
+
+			centroids += ab->tree->fdim;
+		}
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters(void* birch, cftree_type::float_type* dataset, size_t rows, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view(dataset, rows), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_strided(void* birch, const cftree_type::float_type* dataset, size_t rows, size_t stride, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view(dataset, rows, stride), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_f32(void* birch, const float* dataset, size_t rows, size_t stride, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view_f32(dataset, rows, stride), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_i16(void* birch, const int16_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view_i16(dataset, rows, stride), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_i8(void* birch, const int8_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view_i8(dataset, rows, stride), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_u8(void* birch, const uint8_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist(ab->index, cftree_type::matrix_view_u8(dataset, rows, stride), pointToCluster);
+
+		API_FP_POST();
+	}
+
+	DLL_API size_t BIRCH_CALL birch_kmeans(void* birch, const cftree_type::float_type* dataset, size_t rows, size_t stride, size_t iteration, int32_t* pointToCluster)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		cftree_type::kmeans_params params;
+		params.max_iteration = iteration;
+		size_t iteration_count = ab->tree->kmeans(cftree_type::matrix_view(dataset, rows, stride), ab->entries, pointToCluster, params).iteration_count;
+
+		ab->tree->prepare_redist(ab->entries, ab->index);
+		ab->tree->assign_leaves(ab->entries);
+
+		API_FP_POST();
+
+		return iteration_count;
+	}
+
+	DLL_API void BIRCH_CALL birch_get_clusters_routed(void* birch, cftree_type::float_type* dataset, size_t rows, int32_t* pointToCluster, double fallback_margin)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		ab->tree->redist_route(cftree_type::matrix_view(dataset, rows), pointToCluster, fallback_margin);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_minibatch_begin(void* birch, bool warm_counts)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		delete ab->minibatch;
+		ab->minibatch = new cftree_type::minibatch_kmeans(ab->entries, warm_counts);
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_minibatch_update(void* birch, cftree_type::float_type* batch, size_t rows)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		if (ab->minibatch)
+			ab->minibatch->update(cftree_type::matrix_view(batch, rows));
+
+		API_FP_POST();
+	}
+
+	DLL_API void BIRCH_CALL birch_minibatch_end(void* birch)
+	{
+		API_FP_PRE();
+
+		api_ptr_t* ab = (api_ptr_t*)birch;
+
+		if (ab->minibatch)
+		{
+			ab->minibatch->get_entries(ab->entries);
+			ab->tree->prepare_redist(ab->entries, ab->index);
+			ab->tree->assign_leaves(ab->entries);
+
+			delete ab->minibatch;
+			ab->minibatch = NULL;
+		}
+
+		API_FP_POST();
+	}
+
+}
\ No newline at end of file
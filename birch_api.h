@@ -0,0 +1,128 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+/** C interface of the birch library (BIRCH.dll / libbirch.so).
+ *
+ * Every function takes the opaque handle returned by birch_create().
+ * Data-points are BIRCH_DIM doubles (or the typed variants) per row; stride is given in elements.
+ */
+
+#ifndef __BIRCH_API_H__
+#define __BIRCH_API_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+/** dimension of data-points handled by the library. */
+#define BIRCH_DIM 192
+
+#if defined(_WIN32)
+	#define BIRCH_CALL __stdcall
+	#ifdef BIRCH_EXPORTS
+		#define DLL_API __declspec(dllexport)
+	#else
+		#define DLL_API __declspec(dllimport)
+	#endif
+#else
+	#define BIRCH_CALL
+	#define DLL_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	DLL_API void* BIRCH_CALL birch_create(float dist_threshold, uint64_t k_limit, uint32_t rebuild_interval);
+	DLL_API void BIRCH_CALL birch_destroy(void* birch);
+
+	/* snapshots of the tree, false on failure */
+	DLL_API bool BIRCH_CALL birch_save(void* birch, const char* path);
+	DLL_API bool BIRCH_CALL birch_load(void* birch, const char* path);
+
+	/* incremental checkpoints: a delta of the changed nodes appended to log_path, or a new base once the log
+	   outgrows compact_ratio times the base. birch_recover returns the number of deltas replayed, -1 on failure */
+	DLL_API bool BIRCH_CALL birch_checkpoint(void* birch, const char* base_path, const char* log_path, double compact_ratio);
+	DLL_API int64_t BIRCH_CALL birch_recover(void* birch, const char* base_path, const char* log_path);
+
+	/* merging a tree built on another shard, or saved by birch_save on another worker, false on failure */
+	DLL_API bool BIRCH_CALL birch_merge(void* birch, void* other);
+	DLL_API bool BIRCH_CALL birch_merge_file(void* birch, const char* path);
+
+	/* phase 1 and 2: building */
+	DLL_API void BIRCH_CALL birch_insert_line(void* birch, double* line);
+	DLL_API void BIRCH_CALL birch_insert_rows(void* birch, const double* data, size_t rows, size_t stride);
+	DLL_API void BIRCH_CALL birch_insert_rows_f32(void* birch, const float* data, size_t rows, size_t stride);
+	DLL_API void BIRCH_CALL birch_insert_rows_i16(void* birch, const int16_t* data, size_t rows, size_t stride);
+	DLL_API void BIRCH_CALL birch_insert_rows_i8(void* birch, const int8_t* data, size_t rows, size_t stride);
+	DLL_API void BIRCH_CALL birch_insert_rows_u8(void* birch, const uint8_t* data, size_t rows, size_t stride);
+	/* rebuilds triggered by k_limit run in the background, insertions going to a side tree meanwhile */
+	DLL_API void BIRCH_CALL birch_background_rebuild(void* birch, bool enable);
+	/* rebuilds spread over insertions, each doing at most budget steps of it, 0 to stop */
+	DLL_API void BIRCH_CALL birch_incremental_rebuild(void* birch, size_t budget);
+	/* rebuilds packing the leaf entries bottom-up in parallel instead of inserting them one by one */
+	DLL_API void BIRCH_CALL birch_bulk_rebuild(void* birch, bool enable);
+	/* rebuilds triggered by k_limit rebuilding the dense subtrees alone, under a threshold of their own, when they can */
+	DLL_API void BIRCH_CALL birch_partial_rebuild(void* birch, bool enable);
+	/* # leaf entries rebuilds triggered by k_limit aim at, as a fraction of k_limit, and how many rebuilds they took */
+	DLL_API void BIRCH_CALL birch_rebuild_target(void* birch, double fill);
+	DLL_API void BIRCH_CALL birch_rebuild_stats(void* birch, uint64_t* overflows, uint64_t* rebuilds);
+	/* buffering the first n_points data-points to choose the starting threshold from, before any insertion */
+	DLL_API void BIRCH_CALL birch_warm_up(void* birch, size_t n_points);
+	/* full leaves merge their closest entries instead of splitting while the merged diameter, or radius,
+	   stays under bound times the threshold, 0 to stop */
+	DLL_API void BIRCH_CALL birch_merge_on_overflow(void* birch, double bound, bool diameter);
+	/* merging refinement after splits, and the share of the entry slots of the nodes and of the leaves in use.
+	   the refinement needs nodes of 3 entries or more, at BIRCH_DIM 192 nodes hold 2 and it never merges */
+	DLL_API void BIRCH_CALL birch_merging_refinement(void* birch, bool enable);
+	DLL_API void BIRCH_CALL birch_occupancy(void* birch, uint64_t* nodes, double* fill, double* leaf_fill);
+
+	/* subcluster handles */
+	DLL_API void BIRCH_CALL birch_track_handles(void* birch, bool track);
+	DLL_API uint64_t BIRCH_CALL birch_insert_line_handle(void* birch, double* line);
+	DLL_API void BIRCH_CALL birch_insert_rows_handles(void* birch, const double* data, size_t rows, size_t stride, uint64_t* handles);
+	DLL_API void BIRCH_CALL birch_resolve_handles(void* birch, const uint64_t* handles, size_t count, int32_t* pointToCluster);
+
+	/* phase 3: clustering */
+	DLL_API size_t BIRCH_CALL birch_compute(void* birch, bool extend, bool cluster);
+	DLL_API void BIRCH_CALL birch_get_centroids(void * birch, double* centroids);
+
+	/* phase 4: redistribution */
+	DLL_API void BIRCH_CALL birch_get_clusters(void* birch, double* dataset, size_t rows, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_strided(void* birch, const double* dataset, size_t rows, size_t stride, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_f32(void* birch, const float* dataset, size_t rows, size_t stride, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_i16(void* birch, const int16_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_i8(void* birch, const int8_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_u8(void* birch, const uint8_t* dataset, size_t rows, size_t stride, int32_t* pointToCluster);
+	DLL_API void BIRCH_CALL birch_get_clusters_routed(void* birch, double* dataset, size_t rows, int32_t* pointToCluster, double fallback_margin);
+	DLL_API size_t BIRCH_CALL birch_kmeans(void* birch, const double* dataset, size_t rows, size_t stride, size_t iteration, int32_t* pointToCluster);
+
+	/* mini-batch k-means over streamed data-points */
+	DLL_API void BIRCH_CALL birch_minibatch_begin(void* birch, bool warm_counts);
+	DLL_API void BIRCH_CALL birch_minibatch_update(void* birch, double* batch, size_t rows);
+	DLL_API void BIRCH_CALL birch_minibatch_end(void* birch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
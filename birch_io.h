@@ -0,0 +1,755 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+/** loading and saving data-points.
+ *
+ * text files hold one data-point per line, values separated by spaces, tabs, commas or semicolons.
+ * files are memory mapped and parsed in line-aligned chunks on all cores.
+ *
+ * binary files are NumPy .npy (version 1.0, little-endian, C order): a short header giving dtype and shape,
+ * then the row-major payload, which is used in place through the mapping.
+ */
+
+#ifndef __BIRCH_IO_H__
+#define	__BIRCH_IO_H__
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <boost/cstdint.hpp>
+#include "oneapi/tbb/scalable_allocator.h"
+#include "oneapi/tbb/blocked_range.h"
+#include "oneapi/tbb/parallel_for.h"
+#include "oneapi/tbb/parallel_pipeline.h"
+#include "oneapi/tbb/info.h"
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+	#include <io.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+/** this exception is produced when a file cannot be read, written or parsed. */
+struct BirchIOError : public std::runtime_error
+{
+	BirchIOError( const std::string& what ) : std::runtime_error(what) {}
+};
+
+/** read-only memory mapping of a whole file. */
+class mapped_file
+{
+public:
+	mapped_file( const char* fname ) : ptr(NULL), length(0)
+	{
+#if defined(_WIN32)
+		file = CreateFileA( fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+		mapping = NULL;
+		LARGE_INTEGER file_size;
+		if( file == INVALID_HANDLE_VALUE || !GetFileSizeEx( file, &file_size ) )
+			_fail( fname );
+		length = (std::size_t)file_size.QuadPart;
+		if( length > 0 )
+		{
+			mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+			ptr = mapping ? (const char*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+			if( ptr == NULL )
+				_fail( fname );
+		}
+#else
+		fd = open( fname, O_RDONLY );
+		struct stat st;
+		if( fd < 0 || fstat( fd, &st ) != 0 )
+			_fail( fname );
+		length = (std::size_t)st.st_size;
+		if( length > 0 )
+		{
+			void* p = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if( p == MAP_FAILED )
+				_fail( fname );
+			ptr = (const char*)p;
+			madvise( p, length, MADV_SEQUENTIAL );
+		}
+#endif
+	}
+
+	~mapped_file() { _close(); }
+
+	const char* data() const { return ptr; }
+	std::size_t size() const { return length; }
+
+private:
+	mapped_file( const mapped_file& );
+	mapped_file& operator=( const mapped_file& );
+
+	void _close()
+	{
+#if defined(_WIN32)
+		if( ptr ) UnmapViewOfFile( ptr );
+		if( mapping ) CloseHandle( mapping );
+		if( file != INVALID_HANDLE_VALUE ) CloseHandle( file );
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if( ptr ) munmap( (void*)ptr, length );
+		if( fd >= 0 ) close( fd );
+		fd = -1;
+#endif
+		ptr = NULL;
+	}
+
+	void _fail( const char* fname )
+	{
+		_close();
+		throw BirchIOError( std::string("cannot map ") + fname );
+	}
+
+#if defined(_WIN32)
+	HANDLE		file;
+	HANDLE		mapping;
+#else
+	int			fd;
+#endif
+	const char*	ptr;
+	std::size_t	length;
+};
+
+/** flushing fp down to the disk, false on failure */
+inline bool sync_file( std::FILE* fp )
+{
+	if( std::fflush( fp ) != 0 )
+		return false;
+#if defined(_WIN32)
+	return _commit( _fileno( fp ) ) == 0;
+#else
+	return fsync( fileno( fp ) ) == 0;
+#endif
+}
+
+/** contiguous row-major matrix of data-points, aligned to cache lines. */
+template<typename T>
+class aligned_matrix
+{
+public:
+	typedef T value_type;
+	enum { alignment = 64 };
+
+	aligned_matrix() : ptr(NULL), n_rows(0), n_cols(0) {}
+	aligned_matrix( std::size_t rows, std::size_t cols ) : ptr(NULL), n_rows(0), n_cols(0) { resize( rows, cols ); }
+	~aligned_matrix() { scalable_aligned_free( ptr ); }
+
+	/** reallocating for rows x cols values, the previous contents are lost. */
+	void resize( std::size_t rows, std::size_t cols )
+	{
+		if( rows * cols != n_rows * n_cols )
+		{
+			scalable_aligned_free( ptr );
+			ptr = NULL;
+			if( rows * cols > 0 )
+			{
+				ptr = (T*)scalable_aligned_malloc( rows * cols * sizeof(T), alignment );
+				if( ptr == NULL )
+					throw std::bad_alloc();
+			}
+		}
+		n_rows = rows;
+		n_cols = cols;
+	}
+
+	void swap( aligned_matrix& rhs )
+	{
+		std::swap( ptr, rhs.ptr );
+		std::swap( n_rows, rhs.n_rows );
+		std::swap( n_cols, rhs.n_cols );
+	}
+
+	T* data() { return ptr; }
+	const T* data() const { return ptr; }
+	std::size_t rows() const { return n_rows; }
+	std::size_t cols() const { return n_cols; }
+	bool empty() const { return n_rows == 0; }
+
+	T* operator[]( std::size_t i ) { return ptr + i * n_cols; }
+	const T* operator[]( std::size_t i ) const { return ptr + i * n_cols; }
+
+private:
+	aligned_matrix( const aligned_matrix& );
+	aligned_matrix& operator=( const aligned_matrix& );
+
+	T*			ptr;
+	std::size_t	n_rows;
+	std::size_t	n_cols;
+};
+
+enum { text_chunk_bytes = 4*1024*1024 }; /** bytes of text parsed by one task */
+
+/** whether c separates two values of a line */
+inline bool _text_is_sep( char c ) { return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r'; }
+
+/** the beginning of the line after the one containing p, or end */
+inline const char* _text_next_line( const char* p, const char* end )
+{
+	const char* nl = (const char*)std::memchr( p, '\n', end - p );
+	return nl ? nl + 1 : end;
+}
+
+/** the first value of the line at p, or NULL for a blank line */
+inline const char* _text_first_value( const char* p, const char* end )
+{
+	while( p < end && _text_is_sep(*p) )
+		++p;
+	return p < end && *p != '\n' ? p : NULL;
+}
+
+/** number of data-points(non-blank lines) in [begin, end) */
+inline std::size_t _text_count_rows( const char* begin, const char* end )
+{
+	std::size_t n = 0;
+	for( const char* p = begin ; p < end ; p = _text_next_line( p, end ) )
+		if( _text_first_value( p, end ) )
+			n++;
+	return n;
+}
+
+/** parsing the data-points of [begin, end) into out, cols values per row.
+ *
+ * missing values are 0, values beyond cols are ignored.
+ */
+template<typename T>
+std::size_t _text_parse_rows( const char* begin, const char* end, T* out, std::size_t cols )
+{
+	std::size_t n = 0;
+	for( const char* line = begin ; line < end ; line = _text_next_line( line, end ) )
+	{
+		const char* p = _text_first_value( line, end );
+		if( p == NULL )
+			continue;
+
+		T* row = out + n * cols;
+		std::size_t k = 0;
+		while( p < end && *p != '\n' )
+		{
+			if( _text_is_sep(*p) )
+			{
+				++p;
+				continue;
+			}
+			if( *p == '+' )
+				++p;
+
+			T value;
+			std::from_chars_result r = std::from_chars( p, end, value );
+			if( r.ec != std::errc() )
+			{
+				const char* eol = (const char*)std::memchr( line, '\n', end - line );
+				throw BirchIOError( "invalid number in line \"" + std::string( line, eol ? eol : end ) + "\"" );
+			}
+			if( k < cols )
+				row[k++] = value;
+			p = r.ptr;
+		}
+		std::fill( row + k, row + cols, T(0) );
+		n++;
+		line = p;
+	}
+	return n;
+}
+
+/** splitting [data, data + size) into chunks of about chunk_bytes ending on line boundaries */
+inline void _text_chunks( const char* data, std::size_t size, std::size_t chunk_bytes, std::vector<const char*>& bounds )
+{
+	const char* end = data + size;
+	bounds.clear();
+	bounds.push_back( data );
+	while( bounds.back() < end )
+	{
+		const char* p = bounds.back();
+		bounds.push_back( (std::size_t)(end - p) > chunk_bytes ? _text_next_line( p + chunk_bytes, end ) : end );
+	}
+}
+
+struct _text_count_body
+{
+	_text_count_body( const std::vector<const char*>& in_bounds, std::vector<std::size_t>& in_offsets ) : bounds(in_bounds), offsets(in_offsets) {}
+
+	void operator()( const tbb::blocked_range<std::size_t>& r ) const
+	{
+		for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+			offsets[i + 1] = _text_count_rows( bounds[i], bounds[i + 1] );
+	}
+
+	const std::vector<const char*>&	bounds;
+	std::vector<std::size_t>&		offsets;
+};
+
+template<typename T>
+struct _text_parse_body
+{
+	_text_parse_body( const std::vector<const char*>& in_bounds, const std::vector<std::size_t>& in_offsets, aligned_matrix<T>& in_items ) : bounds(in_bounds), offsets(in_offsets), items(in_items) {}
+
+	void operator()( const tbb::blocked_range<std::size_t>& r ) const
+	{
+		for( std::size_t i = r.begin() ; i != r.end() ; i++ )
+			_text_parse_rows( bounds[i], bounds[i + 1], items[offsets[i]], items.cols() );
+	}
+
+	const std::vector<const char*>&	bounds;
+	const std::vector<std::size_t>&	offsets;
+	aligned_matrix<T>&				items;
+};
+
+/** loading a text file into items, cols values per data-point.
+ *
+ * lines are counted and then parsed in parallel, each chunk straight into its rows of items.
+ * blank lines are skipped.
+ *
+ * @return	the number of data-points loaded
+ */
+template<typename T>
+std::size_t load_text( const char* fname, aligned_matrix<T>& items, std::size_t cols, std::size_t chunk_bytes = text_chunk_bytes )
+{
+	mapped_file file( fname );
+
+	std::vector<const char*> bounds;
+	_text_chunks( file.data(), file.size(), chunk_bytes, bounds );
+	std::size_t n_chunks = bounds.size() - 1;
+
+	std::vector<std::size_t> offsets( n_chunks + 1, 0 );
+	tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_chunks, 1 ), _text_count_body( bounds, offsets ) );
+	for( std::size_t i = 0 ; i < n_chunks ; i++ )
+		offsets[i + 1] += offsets[i];
+
+	items.resize( offsets[n_chunks], cols );
+	tbb::parallel_for( tbb::blocked_range<std::size_t>( 0, n_chunks, 1 ), _text_parse_body<T>( bounds, offsets, items ) );
+
+	return items.rows();
+}
+
+/** a parsed chunk of a streamed text file, owned by the token carrying it through the pipeline */
+template<typename T>
+struct _text_stream_chunk
+{
+	const char*			begin;
+	const char*			end;
+	aligned_matrix<T>	items;
+
+	typedef std::unique_ptr<_text_stream_chunk> ptr;
+};
+
+template<typename T>
+struct _text_stream_input
+{
+	_text_stream_input( const char*& in_pos, const char* in_end, std::size_t in_chunk_bytes ) : pos(in_pos), end(in_end), chunk_bytes(in_chunk_bytes) {}
+
+	typename _text_stream_chunk<T>::ptr operator()( tbb::flow_control& fc ) const
+	{
+		if( pos >= end )
+		{
+			fc.stop();
+			return NULL;
+		}
+		typename _text_stream_chunk<T>::ptr chunk( new _text_stream_chunk<T>() );
+		chunk->begin = pos;
+		chunk->end = (std::size_t)(end - pos) > chunk_bytes ? _text_next_line( pos + chunk_bytes, end ) : end;
+		pos = chunk->end;
+		return chunk;
+	}
+
+	const char*&	pos;
+	const char*		end;
+	std::size_t		chunk_bytes;
+};
+
+template<typename T>
+struct _text_stream_parse
+{
+	_text_stream_parse( std::size_t in_cols ) : cols(in_cols) {}
+
+	typename _text_stream_chunk<T>::ptr operator()( typename _text_stream_chunk<T>::ptr chunk ) const
+	{
+		chunk->items.resize( _text_count_rows( chunk->begin, chunk->end ), cols );
+		_text_parse_rows( chunk->begin, chunk->end, chunk->items.data(), cols );
+		return chunk;
+	}
+
+	std::size_t cols;
+};
+
+template<typename T, typename sink_type>
+struct _text_stream_output
+{
+	_text_stream_output( sink_type& in_sink, std::size_t& in_rows ) : sink(in_sink), rows(in_rows) {}
+
+	void operator()( typename _text_stream_chunk<T>::ptr chunk ) const
+	{
+		if( !chunk->items.empty() )
+			sink( chunk->items.data(), chunk->items.rows() );
+		rows += chunk->items.rows();
+	}
+
+	sink_type&		sink;
+	std::size_t&	rows;
+};
+
+/** streaming a text file to sink without holding the whole data set.
+ *
+ * chunks are parsed in parallel and handed over in file order as sink( const T* rows, std::size_t n_rows ),
+ * rows being contiguous with cols values each, e.g. cftree_text_sink feeding a CFTree.
+ * an exception of sink, or an invalid number, cancels the pipeline and is thrown again, the chunks in flight
+ * being freed with it.
+ *
+ * @return	the number of data-points streamed
+ */
+template<typename T, typename sink_type>
+std::size_t stream_text( const char* fname, std::size_t cols, sink_type& sink, std::size_t chunk_bytes = text_chunk_bytes )
+{
+	mapped_file file( fname );
+
+	const char* pos = file.data();
+	std::size_t rows = 0;
+	tbb::parallel_pipeline( 2 * tbb::info::default_concurrency(),
+		tbb::make_filter<void, typename _text_stream_chunk<T>::ptr>( tbb::filter_mode::serial_in_order, _text_stream_input<T>( pos, file.data() + file.size(), chunk_bytes ) ) &
+		tbb::make_filter<typename _text_stream_chunk<T>::ptr, typename _text_stream_chunk<T>::ptr>( tbb::filter_mode::parallel, _text_stream_parse<T>( cols ) ) &
+		tbb::make_filter<typename _text_stream_chunk<T>::ptr, void>( tbb::filter_mode::serial_in_order, _text_stream_output<T, sink_type>( sink, rows ) ) );
+	return rows;
+}
+
+/** stream_text() sink inserting the data-points into a CFTree */
+template<typename tree_type, typename T>
+struct cftree_text_sink
+{
+	cftree_text_sink( tree_type& in_tree ) : tree(in_tree) {}
+
+	void operator()( const T* rows, std::size_t n_rows )
+	{
+		tree.insert_rows( typename tree_type::template basic_matrix_view<T>( rows, n_rows ) );
+	}
+
+	tree_type& tree;
+};
+
+/** .npy dtype descriptions of the element types */
+template<typename T> struct npy_dtype;
+template<> struct npy_dtype<double> { static const char* descr() { return "<f8"; } };
+template<> struct npy_dtype<float> { static const char* descr() { return "<f4"; } };
+template<> struct npy_dtype<boost::int64_t> { static const char* descr() { return "<i8"; } };
+template<> struct npy_dtype<boost::uint64_t> { static const char* descr() { return "<u8"; } };
+template<> struct npy_dtype<boost::int32_t> { static const char* descr() { return "<i4"; } };
+template<> struct npy_dtype<boost::uint32_t> { static const char* descr() { return "<u4"; } };
+template<> struct npy_dtype<boost::int16_t> { static const char* descr() { return "<i2"; } };
+template<> struct npy_dtype<boost::int8_t> { static const char* descr() { return "|i1"; } };
+template<> struct npy_dtype<boost::uint8_t> { static const char* descr() { return "|u1"; } };
+
+/** whether fname starts with the .npy magic string */
+inline bool is_npy( const char* fname )
+{
+	char magic[6] = { 0 };
+	std::FILE* fp = std::fopen( fname, "rb" );
+	if( fp == NULL )
+		return false;
+	std::size_t n = std::fread( magic, 1, sizeof(magic), fp );
+	std::fclose( fp );
+	return n == sizeof(magic) && std::memcmp( magic, "\x93NUMPY", sizeof(magic) ) == 0;
+}
+
+/** read-only .npy file of one or two dimensions, mapped in memory.
+ *
+ * one dimensional arrays are seen as a single column.
+ */
+class npy_file
+{
+public:
+	npy_file( const char* fname ) : file(fname), item_size(0), n_rows(0), n_cols(1), payload(NULL)
+	{
+		const char* p = file.data();
+		std::size_t size = file.size();
+		if( size < 10 || std::memcmp( p, "\x93NUMPY", 6 ) != 0 )
+			throw BirchIOError( std::string("not a .npy file: ") + fname );
+
+		std::size_t offset, header_len;
+		if( p[6] == 1 )
+		{
+			header_len = (unsigned char)p[8] | (std::size_t)(unsigned char)p[9] << 8;
+			offset = 10;
+		}
+		else
+		{
+			if( size < 12 )
+				throw BirchIOError( std::string("truncated .npy file: ") + fname );
+			header_len = (unsigned char)p[8] | (std::size_t)(unsigned char)p[9] << 8 | (std::size_t)(unsigned char)p[10] << 16 | (std::size_t)(unsigned char)p[11] << 24;
+			offset = 12;
+		}
+		if( offset + header_len > size )
+			throw BirchIOError( std::string("truncated .npy file: ") + fname );
+
+		std::string header( p + offset, header_len );
+		if( !_parse_header( header ) )
+			throw BirchIOError( std::string("unsupported .npy header in ") + fname + ": " + header );
+
+		// by division, the product of the shape and item size may overflow
+		payload = p + offset + header_len;
+		const std::size_t n_items = (std::size_t)(p + size - payload) / item_size;
+		if( n_cols > 0 && n_rows > n_items / n_cols )
+			throw BirchIOError( std::string("truncated .npy file: ") + fname );
+	}
+
+	/** the dtype description, e.g. "<f8" */
+	const std::string& dtype() const { return descr; }
+	std::size_t rows() const { return n_rows; }
+	std::size_t cols() const { return n_cols; }
+
+	/** whether the elements are of type T */
+	template<typename T>
+	bool is() const { return descr == npy_dtype<T>::descr(); }
+
+	/** the payload as T, the dtype and its size have to match */
+	template<typename T>
+	const T* data() const
+	{
+		if( !is<T>() || item_size != sizeof(T) )
+			throw BirchIOError( std::string("unexpected .npy dtype ") + descr + ", expecting " + npy_dtype<T>::descr() );
+		return (const T*)payload;
+	}
+
+private:
+	/** the value following 'key': in a header dictionary, or NULL */
+	static const char* _find_key( const std::string& header, const char* key )
+	{
+		std::size_t pos = header.find( std::string("'") + key + "'" );
+		if( pos == std::string::npos )
+			return NULL;
+		pos = header.find( ':', pos );
+		if( pos == std::string::npos )
+			return NULL;
+		pos = header.find_first_not_of( " ", pos + 1 );
+		return pos == std::string::npos ? NULL : header.c_str() + pos;
+	}
+
+	bool _parse_header( const std::string& header )
+	{
+		const char* v = _find_key( header, "descr" );
+		if( v == NULL || *v != '\'' )
+			return false;
+		const char* e = std::strchr( v + 1, '\'' );
+		if( e == NULL )
+			return false;
+		descr.assign( v + 1, e );
+		if( descr.size() < 3 || descr[0] == '>' || descr[2] < '0' || descr[2] > '9' )
+			return false;
+		char* end;
+		item_size = (std::size_t)std::strtoull( descr.c_str() + 2, &end, 10 );
+		if( item_size == 0 || *end != '\0' )
+			return false;
+
+		v = _find_key( header, "fortran_order" );
+		if( v == NULL || std::strncmp( v, "False", 5 ) != 0 )
+			return false;
+
+		v = _find_key( header, "shape" );
+		if( v == NULL || *v != '(' )
+			return false;
+		std::size_t dims[2] = { 1, 1 };
+		std::size_t n_dims = 0;
+		for( ++v ; *v != ')' ; )
+		{
+			if( *v == ' ' || *v == ',' )
+			{
+				++v;
+				continue;
+			}
+			if( n_dims == 2 )
+				return false;
+			char* next;
+			dims[n_dims++] = (std::size_t)std::strtoull( v, &next, 10 );
+			if( next == v )
+				return false;
+			v = next;
+		}
+		n_rows = n_dims > 0 ? dims[0] : 1;
+		n_cols = n_dims > 1 ? dims[1] : 1;
+		return true;
+	}
+
+	mapped_file	file;
+	std::string	descr;
+	std::size_t	item_size;
+	std::size_t	n_rows;
+	std::size_t	n_cols;
+	const char*	payload;
+};
+
+/** .npy file written in large buffered blocks, rows appended as they come.
+ *
+ * the header is rewritten with the final number of rows on close(), so the row count needs not be known in advance.
+ */
+template<typename T>
+class npy_writer
+{
+public:
+	enum { buffer_bytes = 4*1024*1024 };
+
+	/** @param cols	values per row, 0 for a one dimensional array */
+	npy_writer( const char* fname, std::size_t in_cols ) : fp(NULL), cols(in_cols), n_rows(0), name(fname)
+	{
+		fp = std::fopen( fname, "wb" );
+		if( fp == NULL )
+			throw BirchIOError( std::string("cannot open ") + fname );
+		std::setvbuf( fp, NULL, _IOFBF, buffer_bytes );
+		_write_header();
+	}
+
+	~npy_writer()
+	{
+		if( fp )
+			std::fclose( fp );
+	}
+
+	/** appending n rows of cols values(or n values of a one dimensional array) */
+	void write( const T* rows, std::size_t n )
+	{
+		std::size_t count = n * (cols ? cols : 1);
+		if( std::fwrite( rows, sizeof(T), count, fp ) != count )
+			throw BirchIOError( "cannot write " + name );
+		n_rows += n;
+	}
+
+	/** finishing the header and closing the file */
+	void close()
+	{
+		if( std::fflush( fp ) != 0 || std::fseek( fp, 0, SEEK_SET ) != 0 )
+			throw BirchIOError( "cannot write " + name );
+		_write_header();
+		int err = std::fclose( fp );
+		fp = NULL;
+		if( err != 0 )
+			throw BirchIOError( "cannot write " + name );
+	}
+
+	std::size_t rows() const { return n_rows; }
+
+private:
+	npy_writer( const npy_writer& );
+	npy_writer& operator=( const npy_writer& );
+
+	/** the header dictionary, the row count taking max_digits characters */
+	std::string _header( std::size_t rows ) const
+	{
+		char buf[160];
+		if( cols )
+			std::snprintf( buf, sizeof(buf), "{'descr': '%s', 'fortran_order': False, 'shape': (%zu, %zu), }", npy_dtype<T>::descr(), rows, cols );
+		else
+			std::snprintf( buf, sizeof(buf), "{'descr': '%s', 'fortran_order': False, 'shape': (%zu,), }", npy_dtype<T>::descr(), rows );
+		return buf;
+	}
+
+	/** writing a header of the same length whatever the row count is, the payload starting 64 bytes aligned */
+	void _write_header()
+	{
+		std::size_t len = 10 + _header( (std::size_t)-1 ).size() + 1;
+		len = (len + 63) / 64 * 64;
+
+		std::string header = _header( n_rows );
+		header.resize( len - 10 - 1, ' ' );
+		header += '\n';
+
+		unsigned char prefix[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (unsigned char)(header.size() & 0xff), (unsigned char)(header.size() >> 8) };
+		if( std::fwrite( prefix, 1, sizeof(prefix), fp ) != sizeof(prefix) || std::fwrite( header.data(), 1, header.size(), fp ) != header.size() )
+			throw BirchIOError( "cannot write " + name );
+	}
+
+	std::FILE*	fp;
+	std::size_t	cols;
+	std::size_t	n_rows;
+	std::string	name;
+};
+
+/** saving a contiguous rows x cols array, cols 0 for a one dimensional array */
+template<typename T>
+void save_npy( const char* fname, const T* data, std::size_t rows, std::size_t cols )
+{
+	npy_writer<T> writer( fname, cols );
+	writer.write( data, rows );
+	writer.close();
+}
+
+/** saving CF entries as a float64 array of n, sum_sq and the linear sums, one row per entry */
+template<typename entry_vec_type>
+void save_entries_npy( const char* fname, const entry_vec_type& entries )
+{
+	typedef typename entry_vec_type::value_type entry_type;
+	const std::size_t dim = sizeof(entry_type::sum) / sizeof(entry_type::sum[0]);
+	enum { block_rows = 1024 };
+
+	npy_writer<double> writer( fname, dim + 2 );
+	std::vector<double> block;
+	block.reserve( block_rows * (dim + 2) );
+	for( std::size_t i = 0 ; i < entries.size() ; i++ )
+	{
+		const entry_type& e = entries[i];
+		block.push_back( (double)e.n );
+		block.push_back( (double)e.sum_sq );
+		block.insert( block.end(), e.sum, e.sum + dim );
+		if( (i + 1) % block_rows == 0 || i + 1 == entries.size() )
+		{
+			writer.write( &block[0], block.size() / (dim + 2) );
+			block.clear();
+		}
+	}
+	writer.close();
+}
+
+/** loading CF entries saved by save_entries_npy() */
+template<typename entry_vec_type>
+void load_entries_npy( const char* fname, entry_vec_type& entries )
+{
+	typedef typename entry_vec_type::value_type entry_type;
+	const std::size_t dim = sizeof(entry_type::sum) / sizeof(entry_type::sum[0]);
+
+	npy_file file( fname );
+	if( file.cols() != dim + 2 )
+		throw BirchIOError( std::string("unexpected number of columns in ") + fname );
+
+	const double* rows = file.data<double>();
+	entries.resize( file.rows() );
+	for( std::size_t i = 0 ; i < file.rows() ; i++ )
+	{
+		const double* row = rows + i * (dim + 2);
+		entry_type& e = entries[i];
+		e = entry_type();
+		e.n = (std::size_t)row[0];
+		e.sum_sq = row[1];
+		std::copy( row + 2, row + 2 + dim, e.sum );
+	}
+}
+
+#endif
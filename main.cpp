@@ -18,7 +18,7 @@
  */
 
 
-/** Simple test code for birch-clustering algorithm
+/** Command line driver for birch-clustering algorithm
  *
  * BIRCH has 4 phases: building, compacting, clustering, redistribution.
  * 
@@ -26,269 +26,511 @@
  * compacting - make cftree smaller enlarging the range of sub-clusters
  * clustering - clustering sub-clusters(summarized clusters) using the existing clustering algorithm
  * redistribution - labeling data-points to the closest center
+ *
+ * usage: birch [options] input-file [output-file]
+ *	each line of input-file holds cftree_type::fdim values separated by spaces, tabs, commas or semicolons,
+ *	output-file(default "item_cid.txt") receives the lines with the cluster id appended.
+ *	with -s, input-file is parsed twice, building and then labeling, instead of being held in memory.
+ *	input-file may also be a .npy file, clustered in place through its mapping.
+ *
+ * usage: birch -M [options] merged-tree input-tree...
+ *	merges trees saved with -b, or leaf entries saved with -l, built on separate shards, into merged-tree.
  */
 
 #include "CFTree.h"
+#include "CFForest.h"
+#include "birch_io.h"
+#include "oneapi/tbb/global_control.h"
+#include "oneapi/tbb/tick_count.h"
 
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <iostream>
+#include <memory>
 
 #include <time.h>
 
 #include <cstdio>
+#include <cstdlib>
 
 typedef CFTree<192> cftree_type;
+typedef CFForest<192> cfforest_type;
 
-static cftree_type::float_type randf()
-{
-	return rand()/(cftree_type::float_type)RAND_MAX;
-}
+typedef aligned_matrix<cftree_type::float_type> items_type;
 
-struct item_type
+/** wall-clock timer of a phase, reported to stderr when the phase ends */
+class phase_timer
 {
-	item_type() : id(0) { std::fill( item, item + sizeof(item)/sizeof(item[0]), 0 ); }
-	item_type(cftree_type::float_type* in_item ) : id(0) { std::copy(in_item, in_item+sizeof(item)/sizeof(item[0]), item); }
-	cftree_type::float_type& operator[]( int i ) { return item[i]; }
-	cftree_type::float_type operator[]( int i ) const { return item[i]; }
-	std::size_t size() const { return sizeof(item)/sizeof(item[0]); }
+public:
+	phase_timer( const char* in_name ) : name(in_name), start(tbb::tick_count::now()) {}
+	~phase_timer() { std::cerr << name << ": " << (tbb::tick_count::now() - start).seconds() << "s" << std::endl; }
 
-	int& cid() { return id; }
-	const int cid() const { return id; }
+private:
+	const char* name;
+	tbb::tick_count start;
+};
 
-	cftree_type::float_type item[cftree_type::fdim];
-	int id;
+/** command line options */
+struct options_type
+{
+	options_type() : birch_threshold(0.25f/(cftree_type::float_type)cftree_type::fdim), k_limit(0), rebuild_interval(1000), warm_up(0), merge_bound(0),
+		dist_func(cftree_type::_DistD0), absorb_dist_func(cftree_type::_DistD0), threads(0), kmeans_iteration(0), partitions(1), streaming(false),
+		merging(false), refinement(false), partial(false), input(NULL), output("item_cid.txt"), leaf_output(NULL), cluster_output(NULL), tree_output(NULL), tree_input(NULL) {}
+
+	cftree_type::float_type		birch_threshold;
+	std::size_t					k_limit;
+	uint32_t					rebuild_interval;
+	std::size_t					warm_up;		/** # data-points buffered to choose the starting threshold, see CFTree::warm_up() */
+	cftree_type::float_type		merge_bound;	/** diameter bound of entries merged by full leaves, see CFTree::merge_on_overflow() */
+	cftree_type::dist_func_type	dist_func;
+	cftree_type::dist_func_type	absorb_dist_func;
+	int							threads;
+	std::size_t					kmeans_iteration;
+	std::size_t					partitions;		/** # trees of a CFForest, 1 for a single tree */
+	bool						streaming;
+	bool						merging;
+	bool						refinement;		/** merging refinement after splits, see CFTree::merging_refinement() */
+	bool						partial;		/** rebuilding dense subtrees alone, see CFTree::rebuild_partially() */
+	const char*					input;
+	const char*					output;
+	const char*					leaf_output;	/** .npy receiving the leaf entries */
+	const char*					cluster_output;	/** .npy receiving the cluster entries */
+	const char*					tree_output;	/** snapshot receiving the built tree, instead of clustering */
+	const char*					tree_input;		/** snapshot of a tree to cluster with, instead of building one */
 };
 
-template<typename T>
-static void print_items( const std::string fname, T& items )
+/** whether fname has the .npy extension */
+static bool has_npy_extension( const char* fname )
 {
-	struct _compare_item_id
-	{
-		bool operator()( const item_type& lhs, const item_type& rhs ) const { return lhs.cid() < rhs.cid(); }
-	};
+	std::string s(fname);
+	return s.size() >= 4 && s.compare( s.size() - 4, 4, ".npy" ) == 0;
+}
 
-	std::ofstream fout(fname.c_str());
-	for( std::size_t i = 0 ; i < items.size() ; i++ )
+/** writing rows with their cluster ids appended */
+template<typename T>
+static void print_rows( std::ostream& out, const T* rows, std::size_t n_rows, std::size_t stride, const boost::int32_t* cids )
+{
+	for( std::size_t i = 0 ; i < n_rows ; i++ )
 	{
+		const T* row = rows + i * stride;
 		for( std::size_t d = 0 ; d < cftree_type::fdim ; d++ )
-			fout << items[i].item[d] << " ";
-		fout << items[i].cid() << std::endl;
+			out << +row[d] << " ";
+		out << cids[i] << '\n';
 	}
-	fout.close();
 }
 
-typedef std::vector<item_type> items_type;
-static void load_items( const char* fname, items_type& items )
+/** writing the result, the labels alone for a .npy output */
+template<typename T>
+static void print_items( const char* fname, const cftree_type::basic_matrix_view<T>& items, const boost::int32_t* cids )
 {
-	if( fname )
+	if( has_npy_extension( fname ) )
 	{
-		std::ifstream fin(fname);
-		std::string line;
-		std::size_t cnt = 0;
-		while( std::getline( fin, line ) )
-			cnt++;
-		items.reserve(cnt);
+		save_npy( fname, cids, items.rows, 0 );
+		return;
+	}
 
-		fin.clear();
-		fin.seekg(0);
+	std::ofstream fout(fname);
+	print_rows( fout, items.data, items.rows, items.stride, cids );
+	fout.close();
+	if( !fout )
+		throw BirchIOError( std::string("cannot write ") + fname );
+}
 
-		while( std::getline( fin, line ) )
-		{
-			std::stringstream ss(line);
+/** stream_text() sink labeling the data-points and writing them out */
+struct redist_print_sink
+{
+	redist_print_sink( const cftree_type& in_tree, const cftree_type::redist_index& in_index, std::ostream* in_text, npy_writer<boost::int32_t>* in_labels ) :
+		tree(in_tree), index(in_index), text(in_text), labels(in_labels) {}
 
-			cftree_type::item_vec_type item( cftree_type::fdim );
-			for( std::size_t k = 0 ; k < item.size() ; k++ )
-				ss >> item[k];
+	void operator()( const cftree_type::float_type* rows, std::size_t n_rows )
+	{
+		cids.resize( n_rows );
+		tree.redist( index, cftree_type::matrix_view( rows, n_rows ), &cids[0] );
+		if( labels )
+			labels->write( &cids[0], n_rows );
+		else
+			print_rows( *text, rows, n_rows, cftree_type::fdim, &cids[0] );
+	}
 
-			items.push_back( &item[0] );
-		}
+	const cftree_type&					tree;
+	const cftree_type::redist_index&	index;
+	std::ostream*						text;
+	npy_writer<boost::int32_t>*			labels;
+	std::vector<boost::int32_t>			cids;
+};
 
-		fin.close();
+/** rebuilding, clustering and exporting the entries, phase 2 and 3 */
+static void cluster_tree( cftree_type& tree, const options_type& opts, cftree_type::cfentry_vec_type& entries )
+{
+	// merging overlayed sub-clusters by rebuilding
+	{
+		phase_timer t("rebuild");
+		tree.rebuild(false);
 	}
-	else
+	const cftree_type::rebuild_stats& stats = tree.get_rebuild_stats();
+	if( stats.overflows > 0 )
+		std::cerr << stats.rebuilds << " rebuilds for " << stats.overflows << " overflows of k_limit, " << stats.partial_rebuilds << " of dense subtrees" << std::endl;
+	if( stats.leaf_merges > 0 )
+		std::cerr << stats.leaf_merges << " merges in full leaves" << std::endl;
+	if( opts.refinement )
 	{
-		items.reserve(100000);
-		for( std::size_t i = 0 ; i < items.capacity() ; i++ )
-		{
-			cftree_type::item_vec_type item( cftree_type::fdim );
-			for( std::size_t k = 0 ; k < item.size() ; k++ )
-				item[k] = randf();
-			items.push_back( item_type(&item[0]) );
-		}
+		cftree_type::occupancy_stats occ = tree.get_occupancy_stats();
+		std::cerr << occ.nodes << " nodes, " << occ.depth << " levels, fill " << occ.fill() << ", leaf fill " << occ.leaf_fill() << std::endl;
+	}
+	if( opts.leaf_output )
+	{
+		cftree_type::cfentry_vec_type leaves;
+		tree.get_entries( leaves );
+		save_entries_npy( opts.leaf_output, leaves );
+	}
+
+	// phase 3: clustering sub-clusters using the existing clustering algorithm
+	{
+		phase_timer t("cluster");
+		tree.cluster( entries );
 	}
+	std::cerr << entries.size() << " clusters" << std::endl;
+	if( opts.cluster_output )
+		save_entries_npy( opts.cluster_output, entries );
 }
 
-int main( int argc, char* argv[] )
+/** rebuilding the trees of a forest, clustering and exporting the entries, phase 2 and 3 */
+static void cluster_forest( cfforest_type& forest, const options_type& opts, cftree_type::cfentry_vec_type& entries )
 {
-	//if( argc != 4 )
-	//{
-	//	std::cout << "usage: birch (input-file) (range-threshold) (output-file)" << std::endl;
-	//	return 0;
-	//}
-
-	//// load or generate items
-	//items_type items;
-	//load_items( argc >=2 ? argv[1] : NULL, items );
-
-	//std::cout << items.size() << " items loaded" << std::endl;
-	//
-	//cftree_type::float_type birch_threshold = argc >=3 ? (cftree_type::float_type)atof(argv[2]) : 0.25f/(cftree_type::float_type)cftree_type::fdim;
-	//cftree_type tree(birch_threshold, 512*1024*1024);
-
-	//// phase 1 and 2: building, compacting when overflows memory limit
-	//for( std::size_t i = 0 ; i < items.size() ; i++ )
-	//	tree.insert( &items[i][0] );
-
-	//// phase 2 or 3: compacting? or clustering?
-	//// merging overlayed sub-clusters by rebuilding true
-	//tree.rebuild(false);
-
-	//// phase 3: clustering sub-clusters using the existing clustering algorithm
-	//cftree_type::cfentry_vec_type entries;
-	//std::vector<int> cid_vec;
-	//tree.cluster( entries );
-
-	//// phase 4: redistribution
-
-	//// @comment ts - it is also possible to another clustering algorithm hereafter
-	////				for example, we have k initial points for k-means clustering algorithm
-	////tree.redist_kmeans( items, entries, 0 );
-
-	//std::vector<int> item_cids;
-	//tree.redist( items.begin(), items.end(), entries, item_cids );
-	//for( std::size_t i = 0 ; i < item_cids.size() ; i++ )
-	//	items[i].cid() = item_cids[i];
-	//print_items( argc >=4 ? argv[3] : "item_cid.txt" , items);
+	{
+		phase_timer t("rebuild");
+		forest.rebuild(false);
+	}
+	if( opts.leaf_output )
+	{
+		cftree_type::cfentry_vec_type leaves;
+		forest.get_entries( leaves );
+		save_entries_npy( opts.leaf_output, leaves );
+	}
 
-	return 0;
+	{
+		phase_timer t("cluster");
+		forest.cluster( entries );
+	}
+	std::cerr << entries.size() << " clusters" << std::endl;
+	if( opts.cluster_output )
+		save_entries_npy( opts.cluster_output, entries );
 }
 
-extern "C"
+/** the whole pipeline over data-points held in memory */
+template<typename T>
+static int cluster_items( const cftree_type::basic_matrix_view<T>& items, const options_type& opts )
 {
-	#define DLL_API __declspec(dllexport)
-
-	#define API_FP_PRE() \
-		unsigned int _cFP; \
-		_controlfp_s(&_cFP, 0, 0); \
-		_set_controlfp(0x1f, 0x1f);
-
-	#define API_FP_POST() \
-		_set_controlfp(_cFP, 0x1f); \
-		_clearfp();
-
-	class api_ptr_t {
-		public:
-			cftree_type::cfentry_vec_type entries;
-			cftree_type* tree;
+	std::cerr << items.rows << " items loaded" << std::endl;
+	if( items.rows == 0 )
+		return 1;
 
-			api_ptr_t(void) {};
-	};
+	cftree_type tree( opts.birch_threshold, opts.k_limit, opts.rebuild_interval, opts.dist_func, opts.absorb_dist_func );
+	std::unique_ptr<cfforest_type> forest;
 
-	DLL_API void* __stdcall birch_create(float dist_threshold, uint64_t k_limit, uint32_t rebuild_interval)
+	// phase 1 and 2: building, compacting when overflows k_limit
+	if( opts.tree_input )
 	{
-		API_FP_PRE();
-
-		api_ptr_t* ab = new api_ptr_t();
-		ab->tree = new cftree_type(dist_threshold, k_limit, rebuild_interval);
+		phase_timer t("load tree");
+		tree.load( opts.tree_input );
+	}
+	else if( opts.partitions > 1 )
+	{
+		phase_timer t("build");
+		forest.reset( new cfforest_type( opts.partitions, opts.birch_threshold, opts.k_limit, opts.rebuild_interval, opts.dist_func, opts.absorb_dist_func ) );
+		for( std::size_t p = 0 ; p < forest->size() ; p++ )
+		{
+			forest->tree(p).warm_up( opts.warm_up / opts.partitions );
+			forest->tree(p).merge_on_overflow( opts.merge_bound );
+			forest->tree(p).merging_refinement( opts.refinement );
+			forest->tree(p).rebuild_partially( opts.partial );
+		}
+		forest->insert_rows( items );
+	}
+	else
+	{
+		phase_timer t("build");
+		tree.warm_up( opts.warm_up );
+		tree.merge_on_overflow( opts.merge_bound );
+		tree.merging_refinement( opts.refinement );
+		tree.rebuild_partially( opts.partial );
+		tree.insert_rows( items );
+	}
+	if( opts.tree_output )
+	{
+		for( std::size_t p = 0 ; forest && p < forest->size() ; p++ )
+			tree.merge( forest->tree(p) );
+		tree.save( opts.tree_output );
+		return 0;
+	}
 
-		API_FP_POST();
+	cftree_type::cfentry_vec_type entries;
+	if( forest )
+		cluster_forest( *forest, opts, entries );
+	else
+		cluster_tree( tree, opts, entries );
 
-		return ab;
+	// phase 4: redistribution, optionally refined by k-means seeded with the clusters
+	std::vector<boost::int32_t> item_cids( items.rows );
+	{
+		phase_timer t("redist");
+		if( opts.kmeans_iteration > 0 )
+		{
+			tree.redist_kmeans( items, entries, &item_cids[0], opts.kmeans_iteration );
+		}
+		else
+		{
+			cftree_type::redist_index index;
+			tree.prepare_redist( entries, index );
+			tree.redist( index, items, &item_cids[0] );
+		}
 	}
 
-	DLL_API void __stdcall birch_destroy(void* birch)
 	{
-		API_FP_PRE();
-
-		api_ptr_t* ab = (api_ptr_t*) birch;
+		phase_timer t("write");
+		print_items( opts.output, items, &item_cids[0] );
+	}
+	return 0;
+}
 
-		delete ab->tree;
-		delete ab;
+/** the whole pipeline streaming a text file twice, building and then labeling */
+static int cluster_stream( const options_type& opts )
+{
+	cftree_type tree( opts.birch_threshold, opts.k_limit, opts.rebuild_interval, opts.dist_func, opts.absorb_dist_func );
 
-		API_FP_POST();
+	// phase 1 and 2: building, compacting when overflows k_limit
+	if( opts.tree_input )
+	{
+		phase_timer t("load tree");
+		tree.load( opts.tree_input );
 	}
-
-	DLL_API void __stdcall birch_insert_line(void* birch, cftree_type::float_type* line)
+	else
 	{
-		API_FP_PRE();
+		std::size_t n_items;
+		{
+			phase_timer t("build");
+			tree.warm_up( opts.warm_up );
+			tree.merge_on_overflow( opts.merge_bound );
+			tree.merging_refinement( opts.refinement );
+			tree.rebuild_partially( opts.partial );
+			cftree_text_sink<cftree_type, cftree_type::float_type> sink( tree );
+			n_items = stream_text<cftree_type::float_type>( opts.input, cftree_type::fdim, sink );
+		}
+		std::cerr << n_items << " items loaded" << std::endl;
+		if( n_items == 0 )
+			return 1;
+	}
+	if( opts.tree_output )
+	{
+		tree.save( opts.tree_output );
+		return 0;
+	}
 
-		api_ptr_t* ab = (api_ptr_t*) birch;
+	cftree_type::cfentry_vec_type entries;
+	cluster_tree( tree, opts, entries );
 
-		ab->tree->insert(line);
+	// phase 4: redistribution
+	phase_timer t("redist");
+	cftree_type::redist_index index;
+	tree.prepare_redist( entries, index );
 
-		API_FP_POST();
+	if( has_npy_extension( opts.output ) )
+	{
+		npy_writer<boost::int32_t> labels( opts.output, 0 );
+		redist_print_sink sink( tree, index, NULL, &labels );
+		stream_text<cftree_type::float_type>( opts.input, cftree_type::fdim, sink );
+		labels.close();
 	}
-
-	DLL_API size_t __stdcall birch_compute(void* birch, bool extend, bool cluster)
+	else
 	{
-		API_FP_PRE();
+		std::ofstream fout( opts.output );
+		redist_print_sink sink( tree, index, &fout, NULL );
+		stream_text<cftree_type::float_type>( opts.input, cftree_type::fdim, sink );
+		fout.close();
+		if( !fout )
+			throw BirchIOError( std::string("cannot write ") + opts.output );
+	}
+	return 0;
+}
 
-		api_ptr_t* ab = (api_ptr_t*)birch;
+/** the whole pipeline over the payload of a .npy file, in place */
+template<typename T>
+static int cluster_npy( const npy_file& file, const options_type& opts )
+{
+	return cluster_items( cftree_type::basic_matrix_view<T>( file.data<T>(), file.rows() ), opts );
+}
 
-		ab->tree->rebuild(extend);
+/** merging trees or leaf entries of separate shards into one tree, saved to files[0] */
+static int merge_trees( const std::vector<const char*>& files, const options_type& opts )
+{
+	phase_timer t("merge");
+	cftree_type tree( opts.birch_threshold, opts.k_limit, opts.rebuild_interval, opts.dist_func, opts.absorb_dist_func );
 
-		if (cluster)
-			ab->tree->cluster(ab->entries);
+	for( std::size_t i = 1 ; i < files.size() ; i++ )
+	{
+		if( has_npy_extension( files[i] ) )
+		{
+			cftree_type::cfentry_vec_type entries;
+			load_entries_npy( files[i], entries );
+			tree.merge_entries( entries );
+		}
+		else if( i == 1 )
+		{
+			// the first tree is taken as it is, with its parameters
+			tree.load( files[i] );
+		}
 		else
-			ab->tree->get_entries(ab->entries);
-
+		{
+			tree.merge( cftree_type::snapshot_view( files[i] ) );
+		}
+	}
 
-		API_FP_POST();
+	tree.save( files[0] );
+	return 0;
+}
 
-		return ab->entries.size();
-	}
+static cftree_type::dist_func_type parse_metric( const char* name )
+{
+	std::string s(name);
+	if( s == "D0" ) return cftree_type::_DistD0;
+	if( s == "D1" ) return cftree_type::_DistD1;
+	if( s == "D2" ) return cftree_type::_DistD2;
+	if( s == "D3" ) return cftree_type::_DistD3;
+	return NULL;
+}
 
-	DLL_API void __stdcall birch_get_centroids(void * birch, cftree_type::float_type* centroids)
-	{
-		API_FP_PRE();
+static int usage()
+{
+	std::cerr << "usage: birch [options] input-file [output-file]\n"
+		"       birch -M [options] merged-tree input-tree...\n"
+		"  -t threshold    range threshold of sub-clusters (default 0.25/dim)\n"
+		"  -k k_limit      maximum number of leaf entries, 0 for no limit (default 0)\n"
+		"  -r interval     insertions between k_limit checks (default 1000)\n"
+		"  -w points       buffer the first points to choose the starting threshold for -k (default 0)\n"
+		"  -g bound        merge entries of full leaves instead of splitting them, up to a diameter of bound*threshold (default 0)\n"
+		"  -R              merging refinement after splits, filling nodes more\n"
+		"  -P              rebuild the dense subtrees alone for -k when they can make room\n"
+		"  -m metric       clustering distance D0, D1, D2 or D3 (default D0)\n"
+		"  -a metric       absorbing distance D0, D1, D2 or D3 (default D0)\n"
+		"  -j threads      number of worker threads, 0 for all cores (default 0)\n"
+		"  -i iteration    k-means iterations refining the clusters (default 0)\n"
+		"  -s              stream a text input-file instead of loading it, not with -i\n"
+		"  -p partitions   insert into independent trees in parallel, not with -s (default 1)\n"
+		"  -l file.npy     save the leaf entries after rebuilding\n"
+		"  -e file.npy     save the cluster entries\n"
+		"  -b tree         save the built tree and stop, for a later -M or -T\n"
+		"  -T tree         cluster with a saved tree instead of building one\n"
+		"  -M              merge saved trees or leaf entries(.npy) of separate shards\n"
+		"input-file is text or .npy(float64, float32, int16, int8 or uint8),\n"
+		"an output-file named *.npy receives the int32 cluster ids alone." << std::endl;
+	return 1;
+}
 
-		api_ptr_t* ab = (api_ptr_t*) birch;
+int main( int argc, char* argv[] )
+{
+	options_type opts;
+	std::vector<const char*> files;
 
-		for (std::size_t i = 0; i < ab->entries.size(); i++)
+	for( int i = 1 ; i < argc ; i++ )
+	{
+		std::string opt(argv[i]);
+		if( opt.size() != 2 || opt[0] != '-' )
+		{
+			files.push_back(argv[i]);
+			continue;
+		}
+		if( opt[1] == 's' )
+		{
+			opts.streaming = true;
+			continue;
+		}
+		if( opt[1] == 'M' )
+		{
+			opts.merging = true;
+			continue;
+		}
+		if( opt[1] == 'R' )
 		{
-			const cftree_type::CFEntry& e = ab->entries[i];
-			
-			std::copy(e.sum, e.sum + ab->tree->fdim, centroids);
-			
-			cftree_type::float_type inv_n = 1.0 / e.n;
-
-			for (std::size_t j = 0; j < ab->tree->fdim; j++)
-			{
-				centroids[j] *= inv_n;
-			}	
-
-			centroids += ab->tree->fdim;
+			opts.refinement = true;
+			continue;
 		}
+		if( opt[1] == 'P' )
+		{
+			opts.partial = true;
+			continue;
+		}
+		if( i + 1 >= argc )
+			return usage();
 
-		API_FP_POST();
+		const char* val = argv[++i];
+		switch( opt[1] )
+		{
+		case 't': opts.birch_threshold = (cftree_type::float_type)atof(val); break;
+		case 'k': opts.k_limit = (std::size_t)strtoull(val, NULL, 10); break;
+		case 'r': opts.rebuild_interval = (uint32_t)strtoul(val, NULL, 10); break;
+		case 'w': opts.warm_up = (std::size_t)strtoull(val, NULL, 10); break;
+		case 'g': opts.merge_bound = (cftree_type::float_type)atof(val); break;
+		case 'm': opts.dist_func = parse_metric(val); break;
+		case 'a': opts.absorb_dist_func = parse_metric(val); break;
+		case 'j': opts.threads = atoi(val); break;
+		case 'i': opts.kmeans_iteration = (std::size_t)strtoull(val, NULL, 10); break;
+		case 'p': opts.partitions = (std::size_t)strtoull(val, NULL, 10); break;
+		case 'l': opts.leaf_output = val; break;
+		case 'e': opts.cluster_output = val; break;
+		case 'b': opts.tree_output = val; break;
+		case 'T': opts.tree_input = val; break;
+		default: return usage();
+		}
 	}
+	if( files.empty() || (opts.merging ? files.size() < 2 : files.size() > 2) || opts.dist_func == NULL || opts.absorb_dist_func == NULL || opts.rebuild_interval == 0 || (opts.streaming && (opts.kmeans_iteration > 0 || opts.partitions > 1)) )
+		return usage();
+	opts.input = files[0];
+	if( files.size() >= 2 )
+		opts.output = files[1];
 
-	DLL_API void __stdcall birch_get_clusters(void* birch, cftree_type::float_type* dataset, size_t rows, int32_t* pointToCluster)
-	{
-		API_FP_PRE();
-
-		api_ptr_t* ab = (api_ptr_t*)birch;
+	std::unique_ptr<tbb::global_control> parallelism;
+	if( opts.threads > 0 )
+		parallelism.reset( new tbb::global_control( tbb::global_control::max_allowed_parallelism, opts.threads ) );
 
-		items_type items;
-		items.reserve(rows);
+	try
+	{
+		if( opts.merging )
+			return merge_trees( files, opts );
 
-		for (std::size_t row = 0; row < rows; row++)
+		if( is_npy( opts.input ) )
 		{
-			items.push_back(dataset);
-			dataset += ab->tree->fdim;
+			npy_file file( opts.input );
+			if( file.cols() != cftree_type::fdim )
+				throw BirchIOError( std::string("expecting ") + std::to_string( (int)cftree_type::fdim ) + " columns in " + opts.input );
+
+			if( file.is<double>() ) return cluster_npy<double>( file, opts );
+			if( file.is<float>() ) return cluster_npy<float>( file, opts );
+			if( file.is<boost::int16_t>() ) return cluster_npy<boost::int16_t>( file, opts );
+			if( file.is<boost::int8_t>() ) return cluster_npy<boost::int8_t>( file, opts );
+			if( file.is<boost::uint8_t>() ) return cluster_npy<boost::uint8_t>( file, opts );
+			throw BirchIOError( "unsupported .npy dtype " + file.dtype() );
 		}
 
-		std::vector<int> item_cids;
-		ab->tree->redist(items.begin(), items.end(), ab->entries, item_cids);
+		if( opts.streaming )
+			return cluster_stream( opts );
 
-		for (std::size_t i = 0; i < item_cids.size(); i++)
+		// load items into one contiguous matrix
+		items_type items;
 		{
-			*pointToCluster++ = item_cids[i];
+			phase_timer t("load");
+			load_text( opts.input, items, cftree_type::fdim );
 		}
-
-
-		API_FP_POST();
+		return cluster_items( cftree_type::matrix_view( items.data(), items.rows() ), opts );
+	}
+	catch( const BirchIOError& e )
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	catch( const cftree_type::CFTreeSnapshotError& e )
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
 	}
-
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+/** Checks of the C interface of the birch library, linked as a client would.
+ *
+ * usage: birch_api_tests [test-name]
+ *	runs every test, or the named one, and exits with 1 if a check failed.
+ *
+ * data-points are integers around the 8 corners of a cube, as in cftree_tests.cpp.
+ */
+
+#include "birch_api.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define ARRAY_COUNT(a)		(sizeof(a)/sizeof(a[0]))
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { if( !(cond) ) { std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); failures++; } } while( 0 )
+
+enum { n_corners = 8, noise = 3 };
+
+/** n rows of BIRCH_DIM values, the corners taken in turn, shifted by a linear congruential generator */
+static std::vector<double> make_data( std::size_t n, uint32_t seed = 1 )
+{
+	std::vector<double> rows;
+	rows.reserve( n * BIRCH_DIM );
+	for( std::size_t r = 0 ; r < n ; r++ )
+	{
+		int c = (int)( r % n_corners );
+		for( std::size_t i = 0 ; i < BIRCH_DIM ; i++ )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			rows.push_back( ( ( c >> ( i % 3 ) ) & 1 ? 100 : 20 ) + (double)( (int)( seed >> 24 ) % ( 2 * noise + 1 ) - noise ) );
+		}
+	}
+	return rows;
+}
+
+/** data-points of the same corner share a label, and the ones of different corners don't */
+static void check_labels( const std::vector<int32_t>& cids )
+{
+	std::size_t mislabeled = 0;
+	for( std::size_t r = 0 ; r < cids.size() ; r++ )
+	{
+		if( cids[r] < 0 || cids[r] != cids[r % n_corners] )
+			mislabeled++;
+		for( std::size_t s = 0 ; r < n_corners && s < r ; s++ )
+			if( cids[r] == cids[s] )
+				mislabeled++;
+	}
+	CHECK( mislabeled == 0 );
+}
+
+static void test_merge()
+{
+	std::size_t n = 400;
+	std::vector<double> a_rows = make_data( n ), b_rows = make_data( n, 2 );
+
+	void* a = birch_create( 5000.0f, 0, 1000 );
+	void* b = birch_create( 5000.0f, 0, 1000 );
+	birch_insert_rows( a, &a_rows[0], n, BIRCH_DIM );
+	birch_insert_rows( b, &b_rows[0], n, BIRCH_DIM );
+	CHECK( birch_merge( a, b ) );
+
+	CHECK( birch_compute( a, false, true ) == n_corners );
+	std::vector<int32_t> cids( n );
+	birch_get_clusters( a, &b_rows[0], n, &cids[0] );
+	check_labels( cids );
+
+	birch_destroy( a );
+	birch_destroy( b );
+}
+
+/** after k-means, labels routed down the tree agree with the ones of the refined centroids */
+static void test_kmeans_routed()
+{
+	std::size_t n = 800;
+	std::vector<double> rows = make_data( n );
+
+	void* birch = birch_create( 5000.0f, 0, 1000 );
+	birch_insert_rows( birch, &rows[0], n, BIRCH_DIM );
+	CHECK( birch_compute( birch, false, true ) == n_corners );
+
+	std::vector<int32_t> cids( n ), routed( n );
+	birch_kmeans( birch, &rows[0], n, BIRCH_DIM, 3, &cids[0] );
+	check_labels( cids );
+	birch_get_clusters_routed( birch, &rows[0], n, &routed[0], 0.0 );
+	CHECK( routed == cids );
+
+	birch_minibatch_begin( birch, true );
+	birch_minibatch_update( birch, &rows[0], n );
+	birch_minibatch_end( birch );
+	birch_get_clusters( birch, &rows[0], n, &cids[0] );
+	check_labels( cids );
+	birch_get_clusters_routed( birch, &rows[0], n, &routed[0], 0.0 );
+	CHECK( routed == cids );
+
+	birch_destroy( birch );
+}
+
+struct test_case
+{
+	const char* name;
+	void (*run)();
+};
+
+static const test_case tests[] =
+{
+	{ "merge", test_merge },
+	{ "kmeans_routed", test_kmeans_routed },
+};
+
+int main( int argc, char* argv[] )
+{
+	bool found = false;
+	for( std::size_t i = 0 ; i < ARRAY_COUNT(tests) ; i++ )
+	{
+		if( argc > 1 && std::strcmp( argv[1], tests[i].name ) != 0 )
+			continue;
+		found = true;
+		int before = failures;
+		tests[i].run();
+		std::printf( "%s: %s\n", tests[i].name, failures == before ? "ok" : "FAILED" );
+	}
+
+	if( !found )
+	{
+		std::fprintf( stderr, "unknown test %s\n", argv[1] );
+		return 2;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+
+/** Checks of the loaders and writers of birch_io.h on small files.
+ *
+ * usage: birch_io_tests [test-name]
+ *	runs every test, or the named one, and exits with 1 if a check failed.
+ *
+ * files are written to the temporary directory and removed afterwards.
+ */
+
+#include "CFTree.h"
+#include "birch_io.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+typedef CFTree<8> cftree_type;
+typedef cftree_type::float_type float_type;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { if( !(cond) ) { std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); failures++; } } while( 0 )
+
+/** path of a file named name in the temporary directory */
+static std::string temp_path( const char* name )
+{
+	return ( std::filesystem::temp_directory_path() / name ).string();
+}
+
+/** n values of a linear congruential generator, so that runs agree */
+template<typename T>
+static std::vector<T> make_values( std::size_t n, boost::uint32_t seed = 1 )
+{
+	std::vector<T> values;
+	for( std::size_t i = 0 ; i < n ; i++ )
+	{
+		seed = seed * 1664525u + 1013904223u;
+		values.push_back( (T)( (int)( seed >> 16 ) % 2001 - 1000 ) / 8 );
+	}
+	return values;
+}
+
+/** a .npy file of header dictionary dict, followed by payload_bytes zero bytes */
+static void write_raw_npy( const std::string& path, const std::string& dict, std::size_t payload_bytes )
+{
+	std::string header = dict;
+	header.resize( ( 10 + header.size() + 1 + 63 ) / 64 * 64 - 10 - 1, ' ' );
+	header += '\n';
+	const unsigned char prefix[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (unsigned char)(header.size() & 0xff), (unsigned char)(header.size() >> 8) };
+
+	std::FILE* fp = std::fopen( path.c_str(), "wb" );
+	CHECK( fp != NULL );
+	std::fwrite( prefix, 1, sizeof(prefix), fp );
+	std::fwrite( header.data(), 1, header.size(), fp );
+	std::vector<char> payload( payload_bytes, 0 );
+	if( !payload.empty() )
+		std::fwrite( &payload[0], 1, payload.size(), fp );
+	std::fclose( fp );
+}
+
+/** whether opening path as a .npy file fails */
+static bool npy_fails( const std::string& path )
+{
+	try
+	{
+		npy_file file( path.c_str() );
+	}
+	catch( BirchIOError& )
+	{
+		return true;
+	}
+	return false;
+}
+
+/** rows written in several blocks read back the same, in two and one dimensions */
+static void test_npy_round_trip()
+{
+	std::string path = temp_path( "birch_io_tests.npy" );
+	std::vector<double> values = make_values<double>( 300 * 5 );
+	{
+		npy_writer<double> writer( path.c_str(), 5 );
+		writer.write( &values[0], 100 );
+		writer.write( &values[100 * 5], 200 );
+		CHECK( writer.rows() == 300 );
+		writer.close();
+	}
+	{
+		npy_file file( path.c_str() );
+		CHECK( file.dtype() == "<f8" );
+		CHECK( file.rows() == 300 && file.cols() == 5 );
+		CHECK( file.is<double>() && !file.is<float>() );
+		CHECK( std::memcmp( file.data<double>(), &values[0], values.size() * sizeof(double) ) == 0 );
+
+		bool thrown = false;
+		try
+		{
+			file.data<float>();
+		}
+		catch( BirchIOError& )
+		{
+			thrown = true;
+		}
+		CHECK( thrown );
+	}
+
+	std::vector<boost::int32_t> labels = make_values<boost::int32_t>( 77 );
+	save_npy( path.c_str(), &labels[0], labels.size(), 0 );
+	{
+		npy_file file( path.c_str() );
+		CHECK( file.dtype() == "<i4" );
+		CHECK( file.rows() == labels.size() && file.cols() == 1 );
+		CHECK( std::memcmp( file.data<boost::int32_t>(), &labels[0], labels.size() * sizeof(boost::int32_t) ) == 0 );
+	}
+	std::filesystem::remove( path );
+}
+
+/** shapes larger than the payload are refused, even when their size in bytes overflows */
+static void test_npy_truncated()
+{
+	std::string path = temp_path( "birch_io_tests_truncated.npy" );
+	write_raw_npy( path, "{'descr': '<f8', 'fortran_order': False, 'shape': (4, 8), }", 4 * 8 * 8 );
+	CHECK( !npy_fails( path ) );
+	write_raw_npy( path, "{'descr': '<f8', 'fortran_order': False, 'shape': (5, 8), }", 4 * 8 * 8 );
+	CHECK( npy_fails( path ) );
+
+	// 2^62 rows of 4 values of 8 bytes make 2^67 bytes, 0 modulo 2^64
+	write_raw_npy( path, "{'descr': '<f8', 'fortran_order': False, 'shape': (4611686018427387904, 4), }", 256 );
+	CHECK( npy_fails( path ) );
+	write_raw_npy( path, "{'descr': '<f8', 'fortran_order': False, 'shape': (4, 4611686018427387904), }", 256 );
+	CHECK( npy_fails( path ) );
+
+	// item sizes which are no number
+	write_raw_npy( path, "{'descr': '<f0', 'fortran_order': False, 'shape': (4,), }", 32 );
+	CHECK( npy_fails( path ) );
+	write_raw_npy( path, "{'descr': '<f-8', 'fortran_order': False, 'shape': (4,), }", 32 );
+	CHECK( npy_fails( path ) );
+	std::filesystem::remove( path );
+}
+
+/** leaf entries saved and loaded back are the same */
+static void test_entries_round_trip()
+{
+	std::vector<float_type> values = make_values<float_type>( 2000 * cftree_type::fdim );
+	cftree_type tree( 2.0, 0, 100 );
+	cftree_type::matrix_view view( &values[0], values.size() / cftree_type::fdim );
+	tree.insert_rows( view );
+
+	cftree_type::cfentry_vec_type entries, loaded;
+	tree.get_entries( entries );
+	CHECK( entries.size() > 1 );
+
+	std::string path = temp_path( "birch_io_tests_entries.npy" );
+	save_entries_npy( path.c_str(), entries );
+	load_entries_npy( path.c_str(), loaded );
+	std::filesystem::remove( path );
+
+	CHECK( loaded.size() == entries.size() );
+	for( std::size_t i = 0 ; i < entries.size() && i < loaded.size() ; i++ )
+	{
+		CHECK( loaded[i].n == entries[i].n );
+		CHECK( loaded[i].sum_sq == entries[i].sum_sq );
+		CHECK( std::memcmp( loaded[i].sum, entries[i].sum, sizeof(entries[i].sum) ) == 0 );
+	}
+}
+
+/** a file of path holding text */
+static void write_text( const std::string& path, const std::string& text )
+{
+	std::FILE* fp = std::fopen( path.c_str(), "wb" );
+	CHECK( fp != NULL );
+	std::fwrite( text.data(), 1, text.size(), fp );
+	std::fclose( fp );
+}
+
+/** stream_text() sink keeping the values, and throwing once it was given fail_after chunks */
+struct collect_sink
+{
+	collect_sink( std::size_t in_fail_after = (std::size_t)-1 ) : n_chunks(0), fail_after(in_fail_after) {}
+
+	void operator()( const double* rows, std::size_t n_rows )
+	{
+		if( n_chunks++ == fail_after )
+			throw BirchIOError( "sink failed" );
+		values.insert( values.end(), rows, rows + n_rows * 3 );
+	}
+
+	std::vector<double>	values;
+	std::size_t			n_chunks;
+	std::size_t			fail_after;
+};
+
+/** load_text() and stream_text() read text the same, in chunks of every size */
+static void check_text( const std::string& text, const std::vector<double>& expected )
+{
+	std::string path = temp_path( "birch_io_tests.txt" );
+	write_text( path, text );
+
+	const std::size_t chunk_sizes[] = { 1, 5, 16, text_chunk_bytes };
+	for( std::size_t i = 0 ; i < ARRAY_COUNT(chunk_sizes) ; i++ )
+	{
+		aligned_matrix<double> items;
+		CHECK( load_text( path.c_str(), items, 3, chunk_sizes[i] ) == expected.size() / 3 );
+		CHECK( items.rows() * items.cols() == expected.size() );
+		CHECK( std::vector<double>( items.data(), items.data() + items.rows() * items.cols() ) == expected );
+
+		collect_sink sink;
+		CHECK( stream_text<double>( path.c_str(), 3, sink, chunk_sizes[i] ) == expected.size() / 3 );
+		CHECK( sink.values == expected );
+	}
+	std::filesystem::remove( path );
+}
+
+/** blank lines, line endings and row lengths */
+static void test_text()
+{
+	const double rows[] =
+	{
+		1, 2, 3,
+		4, 5, 6,
+		7, 8, 0,
+		9, 10, 11,
+		-1.5, 20, 3,
+	};
+	std::vector<double> expected( rows, rows + ARRAY_COUNT(rows) );
+
+	// blank lines are skipped, short rows are padded with 0 and long ones cut
+	check_text( "1 2 3\n\n  \t\n4,5;6\n7\t8\n\n9 10 11 12\n-1.5 +2e1 3\n", expected );
+	// CRLF line endings
+	check_text( "1 2 3\r\n\r\n4,5;6\r\n7\t8\r\n9 10 11 12\r\n-1.5 +2e1 3\r\n", expected );
+	// no newline after the last line, nor after a blank one
+	check_text( "1 2 3\n4,5;6\n7\t8\n9 10 11 12\n-1.5 +2e1 3", expected );
+	check_text( "1 2 3\n4,5;6\n7\t8\n9 10 11 12\n-1.5 +2e1 3\n  ", expected );
+	check_text( "", std::vector<double>() );
+}
+
+/** a sink throwing stops the stream, and the exception comes out of stream_text() */
+static void test_stream_cancel()
+{
+	std::string text;
+	for( int i = 0 ; i < 1000 ; i++ )
+		text += "1 2 3\n";
+	std::string path = temp_path( "birch_io_tests_cancel.txt" );
+	write_text( path, text );
+
+	collect_sink sink( 2 );
+	bool thrown = false;
+	try
+	{
+		stream_text<double>( path.c_str(), 3, sink, 60 );
+	}
+	catch( BirchIOError& )
+	{
+		thrown = true;
+	}
+	CHECK( thrown );
+	CHECK( sink.n_chunks == 3 );
+	CHECK( sink.values.size() < 1000 * 3 );
+
+	// an invalid number too
+	write_text( path, text + "1 x 3\n" + text );
+	collect_sink all;
+	thrown = false;
+	try
+	{
+		stream_text<double>( path.c_str(), 3, all, 60 );
+	}
+	catch( BirchIOError& )
+	{
+		thrown = true;
+	}
+	CHECK( thrown );
+	std::filesystem::remove( path );
+}
+
+struct test_case
+{
+	const char* name;
+	void (*run)();
+};
+
+static const test_case tests[] =
+{
+	{ "npy_round_trip", test_npy_round_trip },
+	{ "npy_truncated", test_npy_truncated },
+	{ "entries_round_trip", test_entries_round_trip },
+	{ "text", test_text },
+	{ "stream_cancel", test_stream_cancel },
+};
+
+int main( int argc, char* argv[] )
+{
+	bool found = false;
+	for( std::size_t i = 0 ; i < ARRAY_COUNT(tests) ; i++ )
+	{
+		if( argc > 1 && std::strcmp( argv[1], tests[i].name ) != 0 )
+			continue;
+		found = true;
+		int before = failures;
+		tests[i].run();
+		std::printf( "%s: %s\n", tests[i].name, failures == before ? "ok" : "FAILED" );
+	}
+
+	if( !found )
+	{
+		std::fprintf( stderr, "unknown test %s\n", argv[1] );
+		return 2;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,919 @@
+/*
+ *  This file is part of birch-clustering-algorithm.
+ *
+ *  birch-clustering-algorithm is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  birch-clustering-algorithm is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with birch-clustering-algorithm.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *	Copyright (C) 2011 Taesik Yoon (otterrrr@gmail.com)
+ */
+/** Checks of CFTree, and of CFForest, on small deterministic data sets.
+/** Checks of CFTree on small deterministic data sets.
+ *
+ * usage: cftree_tests [test-name]
+ *	runs every test, or the named one, and exits with 1 if a check failed.
+ *
+ * data-points are integers around the 8 corners of a cube, so that every input type holds them exactly
+ * and a cluster never spans two corners.
+ */
+
+#include "CFForest.h"
+#include "CFTree.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+typedef CFTree<8> cftree_type;
+typedef cftree_type::float_type float_type;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { if( !(cond) ) { std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); failures++; } } while( 0 )
+
+enum { n_corners = 8, noise = 3 };
+
+/** row-major data-points with the corner each one was drawn around */
+struct data_set
+{
+	std::vector<float_type> rows;
+	std::vector<int> corners;
+
+	std::size_t size() const { return corners.size(); }
+	const float_type* operator[]( std::size_t i ) const { return &rows[i * cftree_type::fdim]; }
+	cftree_type::matrix_view view() const { return cftree_type::matrix_view( &rows[0], size() ); }
+};
+
+/** the i-th dimension of corner c, coordinates being 20 or 100 */
+static float_type corner_coord( int c, std::size_t i )
+{
+	return ( c >> ( i % 3 ) ) & 1 ? 100 : 20;
+}
+
+/** n data-points, the corners taken in turn, shifted by a linear congruential generator so that runs agree */
+static data_set make_data( std::size_t n, boost::uint32_t seed = 1 )
+{
+	data_set data;
+	data.rows.reserve( n * cftree_type::fdim );
+	for( std::size_t r = 0 ; r < n ; r++ )
+	{
+		int c = (int)( r % n_corners );
+		data.corners.push_back( c );
+		for( std::size_t i = 0 ; i < cftree_type::fdim ; i++ )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			data.rows.push_back( corner_coord( c, i ) + (float_type)( (int)( seed >> 24 ) % ( 2 * noise + 1 ) - noise ) );
+		}
+	}
+	return data;
+}
+
+/** copy of the data-points as another type */
+template<typename T>
+static std::vector<T> convert( const data_set& data )
+{
+	return std::vector<T>( data.rows.begin(), data.rows.end() );
+}
+
+static bool same_entries( const cftree_type::cfentry_vec_type& lhs, const cftree_type::cfentry_vec_type& rhs )
+{
+	if( lhs.size() != rhs.size() )
+		return false;
+	for( std::size_t i = 0 ; i < lhs.size() ; i++ )
+	{
+		if( lhs[i].n != rhs[i].n || lhs[i].sum_sq != rhs[i].sum_sq || std::memcmp( lhs[i].sum, rhs[i].sum, sizeof(lhs[i].sum) ) != 0 )
+			return false;
+	}
+	return true;
+}
+
+/** # data-points summarized by entries, and their sum */
+static std::size_t total( const cftree_type::cfentry_vec_type& entries, float_type* sum )
+{
+	std::size_t n = 0;
+	std::fill( sum, sum + cftree_type::fdim, 0 );
+	for( std::size_t i = 0 ; i < entries.size() ; i++ )
+	{
+		n += entries[i].n;
+		for( std::size_t d = 0 ; d < cftree_type::fdim ; d++ )
+			sum[d] += entries[i].sum[d];
+	}
+	return n;
+}
+
+/** entries summarize every data-point, and nothing else */
+static void check_totals( const cftree_type::cfentry_vec_type& entries, const data_set& data )
+{
+	float_type sum[cftree_type::fdim], expected[cftree_type::fdim];
+	CHECK( total( entries, sum ) == data.size() );
+
+	std::fill( expected, expected + cftree_type::fdim, 0 );
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+		for( std::size_t d = 0 ; d < cftree_type::fdim ; d++ )
+			expected[d] += data[r][d];
+	for( std::size_t d = 0 ; d < cftree_type::fdim ; d++ )
+		CHECK( std::fabs( sum[d] - expected[d] ) <= 1e-9 * expected[d] );
+}
+
+/** the corner a cluster lies at, -1 if it is not within half the edge of any */
+static int cluster_corner( const cftree_type::CFEntry& cluster )
+{
+	for( int c = 0 ; c < n_corners ; c++ )
+	{
+		float_type d2 = 0;
+		for( std::size_t i = 0 ; i < cftree_type::fdim ; i++ )
+		{
+			float_type d = cluster.sum[i] / cluster.n - corner_coord( c, i );
+			d2 += d * d;
+		}
+		if( d2 < 40 * 40 )
+			return c;
+	}
+	return -1;
+}
+
+/** clusters tree and checks that the handle of every data-point resolves to a cluster at its corner */
+static void check_handles( cftree_type& tree, const data_set& data, const std::vector<cftree_type::handle_type>& handles )
+{
+	std::srand( 1 );
+	cftree_type::cfentry_vec_type clusters;
+	tree.cluster( clusters );
+
+	CHECK( handles.size() == data.size() );
+	std::size_t misplaced = 0;
+	for( std::size_t r = 0 ; r < handles.size() ; r++ )
+	{
+		int cid = tree.resolve_handle( handles[r] );
+		if( cid < 0 || cid >= (int)clusters.size() || cluster_corner( clusters[cid] ) != data.corners[r] )
+			misplaced++;
+	}
+	CHECK( misplaced == 0 );
+}
+
+/** builds a tree over data, row by row or through insert_rows(), with handles */
+static void build( cftree_type& tree, const data_set& data, bool rows, std::vector<cftree_type::handle_type>& handles )
+{
+	tree.track_handles( true );
+	handles.resize( data.size() );
+	if( rows )
+	{
+		tree.insert_rows( data.view(), &handles[0] );
+	}
+	else
+	{
+		for( std::size_t r = 0 ; r < data.size() ; r++ )
+			handles[r] = tree.insert( const_cast<float_type*>( data[r] ) );
+	}
+	tree.finish_rebuild();
+}
+
+static void test_insert_rows()
+{
+	data_set data = make_data( 5000 );
+
+	cftree_type by_row( 1.0, 0, 1000 ), by_rows( 1.0, 0, 1000 );
+	std::vector<cftree_type::handle_type> row_handles, rows_handles;
+	build( by_row, data, false, row_handles );
+	build( by_rows, data, true, rows_handles );
+	CHECK( row_handles == rows_handles );
+
+	cftree_type::cfentry_vec_type row_entries, rows_entries;
+	by_row.get_entries( row_entries );
+	by_rows.get_entries( rows_entries );
+	CHECK( same_entries( row_entries, rows_entries ) );
+	check_totals( rows_entries, data );
+
+	// same clusters, so the same labels
+	cftree_type::cfentry_vec_type row_clusters, rows_clusters;
+	std::srand( 1 );
+	by_row.cluster( row_clusters );
+	std::srand( 1 );
+	by_rows.cluster( rows_clusters );
+	CHECK( same_entries( row_clusters, rows_clusters ) );
+
+	cftree_type::redist_index row_index, rows_index;
+	by_row.prepare_redist( row_clusters, row_index );
+	by_rows.prepare_redist( rows_clusters, rows_index );
+	std::vector<boost::int32_t> row_cids( data.size() ), rows_cids( data.size() );
+	by_row.redist( row_index, data.view(), &row_cids[0] );
+	by_rows.redist( rows_index, data.view(), &rows_cids[0] );
+	CHECK( row_cids == rows_cids );
+}
+
+static void test_typed_input()
+{
+	data_set data = make_data( 3000 );
+
+	cftree_type::cfentry_vec_type expected;
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( data.view() );
+		tree.get_entries( expected );
+	}
+
+	std::vector<float> f32 = convert<float>( data );
+	std::vector<boost::int16_t> i16 = convert<boost::int16_t>( data );
+	std::vector<boost::int8_t> i8 = convert<boost::int8_t>( data );
+	std::vector<boost::uint8_t> u8 = convert<boost::uint8_t>( data );
+
+	cftree_type::cfentry_vec_type entries;
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( cftree_type::matrix_view_f32( &f32[0], data.size() ) );
+		tree.get_entries( entries );
+		CHECK( same_entries( entries, expected ) );
+	}
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( cftree_type::matrix_view_i16( &i16[0], data.size() ) );
+		tree.get_entries( entries );
+		CHECK( same_entries( entries, expected ) );
+	}
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( cftree_type::matrix_view_i8( &i8[0], data.size() ) );
+		tree.get_entries( entries );
+		CHECK( same_entries( entries, expected ) );
+	}
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( cftree_type::matrix_view_u8( &u8[0], data.size() ) );
+		tree.get_entries( entries );
+		CHECK( same_entries( entries, expected ) );
+	}
+
+	// every other column of a wider array, through the stride
+	std::vector<float_type> wide( data.rows.size() * 2 );
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+		std::copy( data[r], data[r] + cftree_type::fdim, &wide[r * 2 * cftree_type::fdim] );
+	{
+		cftree_type tree( 1.0, 0, 1000 );
+		tree.insert_rows( cftree_type::matrix_view( &wide[0], data.size(), 2 * cftree_type::fdim ) );
+		tree.get_entries( entries );
+		CHECK( same_entries( entries, expected ) );
+	}
+}
+
+/** k-means from the clusters of the tree labels every data-point by its corner, whatever the grain of its tasks */
+static void test_kmeans()
+{
+	data_set data = make_data( 4000 );
+	cftree_type tree( 0.5, 0, 1000 );
+	tree.insert_rows( data.view() );
+	std::srand( 1 );
+	cftree_type::cfentry_vec_type seeds;
+	tree.cluster( seeds );
+
+	cftree_type::kmeans_params params;
+	std::vector<boost::int32_t> cids( data.size() ), fine_cids( data.size() );
+	cftree_type::cfentry_vec_type clusters( seeds ), fine_clusters( seeds );
+	cftree_type::kmeans_stats stats = tree.kmeans( data.view(), clusters, &cids[0], params );
+	params.grain_size = 1;
+	tree.kmeans( data.view(), fine_clusters, &fine_cids[0], params );
+	CHECK( stats.iteration_count > 0 );
+	CHECK( cids == fine_cids );
+	CHECK( same_entries( clusters, fine_clusters ) );
+
+	// the refined clusters are the exact features of their data-points
+	std::vector<std::size_t> counts( clusters.size(), 0 );
+	std::size_t misplaced = 0;
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+	{
+		if( cids[r] < 0 || cids[r] >= (int)clusters.size() || cluster_corner( clusters[cids[r]] ) != data.corners[r] )
+			misplaced++;
+		else
+			counts[cids[r]]++;
+	}
+	CHECK( misplaced == 0 );
+	for( std::size_t c = 0 ; c < clusters.size() ; c++ )
+		CHECK( counts[c] == 0 || clusters[c].n == counts[c] );
+}
+
+static void test_snapshot()
+{
+	data_set data = make_data( 4000 );
+	std::string path = ( std::filesystem::temp_directory_path() / "cftree_tests_snapshot.cft" ).string();
+
+	cftree_type tree( 0.5, 300, 200 );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, true, handles );
+	tree.save( path.c_str() );
+
+	cftree_type loaded( 0.0, 0, 1000 );
+	loaded.load( path.c_str() );
+	std::filesystem::remove( path );
+
+	cftree_type::cfentry_vec_type entries, loaded_entries;
+	tree.get_entries( entries );
+	loaded.get_entries( loaded_entries );
+	CHECK( same_entries( entries, loaded_entries ) );
+	CHECK( loaded.handle_count() == tree.handle_count() );
+	check_handles( loaded, data, handles );
+
+	// the loaded tree goes on like the saved one
+	data_set more = make_data( 1000, 2 );
+	tree.insert_rows( more.view() );
+	loaded.insert_rows( more.view() );
+	tree.get_entries( entries );
+	loaded.get_entries( loaded_entries );
+	CHECK( same_entries( entries, loaded_entries ) );
+}
+
+static void write_file( const std::string& path, const std::vector<char>& bytes )
+{
+	std::FILE* fp = std::fopen( path.c_str(), "wb" );
+	CHECK( fp != NULL && std::fwrite( &bytes[0], 1, bytes.size(), fp ) == bytes.size() );
+	std::fclose( fp );
+}
+
+static std::vector<char> read_file( const std::string& path )
+{
+	std::vector<char> bytes( std::filesystem::file_size( path ) );
+	std::FILE* fp = std::fopen( path.c_str(), "rb" );
+	CHECK( fp != NULL && std::fread( &bytes[0], 1, bytes.size(), fp ) == bytes.size() );
+	std::fclose( fp );
+	return bytes;
+}
+
+/** loading a damaged copy of a snapshot throws and leaves the tree as it was */
+static void check_corrupt( const std::vector<char>& bytes, const std::string& path, cftree_type& tree )
+{
+	write_file( path, bytes );
+
+	cftree_type::cfentry_vec_type before, after;
+	tree.get_entries( before );
+	bool thrown = false;
+	try
+	{
+		tree.load( path.c_str() );
+	}
+	catch( const cftree_type::CFTreeSnapshotError& )
+	{
+		thrown = true;
+	}
+	tree.get_entries( after );
+	CHECK( thrown );
+	CHECK( same_entries( before, after ) );
+}
+
+static void test_corrupt_snapshot()
+{
+	typedef cftree_type::snapshot_header header_type;
+	typedef cftree_type::snapshot_node node_type;
+
+	data_set data = make_data( 4000 );
+	std::string path = ( std::filesystem::temp_directory_path() / "cftree_tests_corrupt.cft" ).string();
+
+	cftree_type tree( 0.5, 300, 200 );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, true, handles );
+	tree.save( path.c_str() );
+
+	std::vector<char> bytes = read_file( path );
+
+	const header_type& h = *(const header_type*)&bytes[0];
+	CHECK( h.node_count > 2 );
+	const std::size_t n_nodes = (std::size_t)h.node_count;
+	const std::size_t first_leaf = (std::size_t)h.first_leaf;
+	struct record_at
+	{
+		static node_type& get( std::vector<char>& copy, std::size_t id ) { return *(node_type*)&copy[sizeof(header_type) + id * sizeof(node_type)]; }
+	};
+
+	// truncated
+	check_corrupt( std::vector<char>( bytes.begin(), bytes.begin() + bytes.size() / 2 ), path, tree );
+	{
+		std::vector<char> copy( bytes );
+		record_at::get( copy, 0 ).size = cftree_type::snapshot_node_entries + 1;
+		check_corrupt( copy, path, tree );
+	}
+	{
+		std::vector<char> copy( bytes );
+		record_at::get( copy, 0 ).entries[0].child = n_nodes + 5;
+		check_corrupt( copy, path, tree );
+	}
+	{
+		// a child reached twice
+		std::vector<char> copy( bytes );
+		record_at::get( copy, 0 ).entries[1].child = record_at::get( copy, 0 ).entries[0].child;
+		check_corrupt( copy, path, tree );
+	}
+	{
+		// a leaf chain going round
+		std::vector<char> copy( bytes );
+		record_at::get( copy, first_leaf ).next = first_leaf;
+		check_corrupt( copy, path, tree );
+	}
+	{
+		std::vector<char> copy( bytes );
+		record_at::get( copy, first_leaf ).entries[0].handle = h.handle_count;
+		check_corrupt( copy, path, tree );
+	}
+	{
+		std::vector<char> copy( bytes );
+		((header_type*)&copy[0])->first_leaf = n_nodes;
+		check_corrupt( copy, path, tree );
+	}
+
+	// the untouched copy still loads
+	write_file( path, bytes );
+	cftree_type loaded( 0.0, 0, 1000 );
+	loaded.load( path.c_str() );
+	std::filesystem::remove( path );
+	cftree_type::cfentry_vec_type entries, loaded_entries;
+	tree.get_entries( entries );
+	loaded.get_entries( loaded_entries );
+	CHECK( same_entries( entries, loaded_entries ) );
+}
+
+/** a base checkpoint and deltas, the last one torn or naming a missing node, replay up to the one before */
+static void test_recover()
+{
+	enum { n_deltas = 5 };
+	std::string base_path = ( std::filesystem::temp_directory_path() / "cftree_tests_base.cft" ).string();
+	std::string log_path = ( std::filesystem::temp_directory_path() / "cftree_tests_log.cfl" ).string();
+
+	cftree_type tree( 0.5, 300, 200 );
+	tree.track_handles( true );
+	tree.insert_rows( make_data( 2000 ).view() );
+	tree.checkpoint_base( base_path.c_str(), log_path.c_str() );
+
+	// the tree after each delta, and where each delta starts
+	std::vector<cftree_type::cfentry_vec_type> expected( n_deltas );
+	std::vector<std::size_t> starts( n_deltas );
+	for( std::size_t k = 0 ; k < n_deltas ; k++ )
+	{
+		tree.insert_rows( make_data( 500, (boost::uint32_t)( k + 2 ) ).view() );
+		starts[k] = (std::size_t)std::filesystem::file_size( log_path );
+		tree.checkpoint_delta( log_path.c_str() );
+		tree.get_entries( expected[k] );
+	}
+	std::vector<char> log = read_file( log_path );
+
+	cftree_type::cfentry_vec_type entries;
+	{
+		cftree_type recovered( 0.0, 0, 1000 );
+		CHECK( recovered.recover( base_path.c_str(), log_path.c_str() ) == n_deltas );
+		recovered.get_entries( entries );
+		CHECK( same_entries( entries, expected[n_deltas - 1] ) );
+	}
+
+	// torn by a crash
+	write_file( log_path, std::vector<char>( log.begin(), log.end() - 20 ) );
+	{
+		cftree_type recovered( 0.0, 0, 1000 );
+		CHECK( recovered.recover( base_path.c_str(), log_path.c_str() ) == n_deltas - 1 );
+		recovered.get_entries( entries );
+		CHECK( same_entries( entries, expected[n_deltas - 2] ) );
+		CHECK( std::filesystem::file_size( log_path ) == starts[n_deltas - 1] );
+	}
+
+	// whole but naming a node that doesn't exist
+	{
+		std::vector<char> copy( log );
+		cftree_type::snapshot_delta_node& node = *(cftree_type::snapshot_delta_node*)&copy[starts[n_deltas - 1] + sizeof(cftree_type::snapshot_delta_header)];
+		node.node.next = (boost::uint64_t)1 << 40;
+		write_file( log_path, copy );
+
+		cftree_type recovered( 0.0, 0, 1000 );
+		CHECK( recovered.recover( base_path.c_str(), log_path.c_str() ) == n_deltas - 1 );
+		recovered.get_entries( entries );
+		CHECK( same_entries( entries, expected[n_deltas - 2] ) );
+	}
+
+	std::filesystem::remove( base_path );
+	std::filesystem::remove( log_path );
+}
+
+/** the merging refinement merges nodes, which checkpoints and handles follow */
+static void test_merging_refinement()
+{
+	std::string base_path = ( std::filesystem::temp_directory_path() / "cftree_tests_refined.cft" ).string();
+	std::string log_path = ( std::filesystem::temp_directory_path() / "cftree_tests_refined.cfl" ).string();
+
+	cftree_type tree( 0.5, 0, 1000 );
+	tree.merging_refinement( true );
+	tree.track_handles( true );
+	tree.checkpoint_base( base_path.c_str(), log_path.c_str() );
+
+	data_set data = make_data( 4000 );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, true, handles );
+	tree.checkpoint_delta( log_path.c_str() );
+	CHECK( tree.get_occupancy_stats().refinement_merges > 0 );
+
+	cftree_type::cfentry_vec_type entries, recovered_entries;
+	tree.get_entries( entries );
+	check_totals( entries, data );
+	check_handles( tree, data, handles );
+
+	cftree_type recovered( 0.0, 0, 1000 );
+	CHECK( recovered.recover( base_path.c_str(), log_path.c_str() ) == 1 );
+	recovered.get_entries( recovered_entries );
+	CHECK( same_entries( entries, recovered_entries ) );
+
+	std::filesystem::remove( base_path );
+	std::filesystem::remove( log_path );
+}
+
+static void test_merge()
+{
+	data_set data = make_data( 6000 );
+	data_set even, odd;
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+	{
+		data_set& half = r % 2 ? odd : even;
+		half.rows.insert( half.rows.end(), data[r], data[r] + cftree_type::fdim );
+		half.corners.push_back( data.corners[r] );
+	}
+
+	cftree_type combined( 0.5, 300, 200 ), a( 0.5, 300, 200 ), b( 0.5, 300, 200 );
+	std::vector<cftree_type::handle_type> combined_handles, a_handles, b_handles;
+	build( combined, data, true, combined_handles );
+	build( a, even, true, a_handles );
+	build( b, odd, true, b_handles );
+
+	std::size_t handle_base = a.handle_count();
+	a.merge( b );
+
+	cftree_type::cfentry_vec_type entries;
+	a.get_entries( entries );
+	check_totals( entries, data );
+	CHECK( a.handle_count() == handle_base + b.handle_count() );
+
+	// handles of b follow the ones of a
+	std::vector<cftree_type::handle_type> handles;
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+		handles.push_back( r % 2 ? handle_base + b_handles[r / 2] : a_handles[r / 2] );
+	check_handles( a, data, handles );
+	check_handles( combined, data, combined_handles );
+
+	// both trees put the same data-points at each corner
+	cftree_type::cfentry_vec_type merged_clusters, combined_clusters;
+	std::srand( 1 );
+	a.cluster( merged_clusters );
+	std::srand( 1 );
+	combined.cluster( combined_clusters );
+	std::size_t merged_n[n_corners] = { 0 }, combined_n[n_corners] = { 0 };
+	for( std::size_t i = 0 ; i < merged_clusters.size() ; i++ )
+		merged_n[ (std::max)( cluster_corner( merged_clusters[i] ), 0 ) ] += merged_clusters[i].n;
+	for( std::size_t i = 0 ; i < combined_clusters.size() ; i++ )
+		combined_n[ (std::max)( cluster_corner( combined_clusters[i] ), 0 ) ] += combined_clusters[i].n;
+	for( int c = 0 ; c < n_corners ; c++ )
+		CHECK( merged_n[c] == combined_n[c] );
+}
+
+/** clusters replaced after cluster() take over routing and handles */
+static void test_assign_leaves()
+{
+	data_set data = make_data( 3000 );
+	cftree_type tree( 0.5, 0, 1000 );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, true, handles );
+
+	std::srand( 1 );
+	cftree_type::cfentry_vec_type clusters;
+	tree.cluster( clusters );
+	CHECK( clusters.size() > n_corners );
+
+	// one cluster per corner, in corner order, as if k-means had gathered them
+	cftree_type::cfentry_vec_type corners( n_corners );
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+		corners[data.corners[r]] += cftree_type::CFEntry( const_cast<float_type*>( data[r] ) );
+	tree.assign_leaves( corners );
+	std::size_t misplaced = 0;
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+		if( tree.resolve_handle( handles[r] ) != data.corners[r] || tree.route( data[r] ) != data.corners[r] )
+			misplaced++;
+	CHECK( misplaced == 0 );
+	CHECK( tree.leaf_clusters().size() == tree.get_occupancy_stats().leaf_entries );
+}
+
+/** a tree with a small k_limit, so that the data-points overflow it many times */
+struct small_tree : public cftree_type
+{
+	small_tree( std::size_t in_limit = 200 ) : cftree_type( 0.5, in_limit, 100 ), limit(in_limit) {}
+
+	std::size_t limit;
+};
+
+/** builds a small tree, checking that rebuilds kept every data-point and handle, and the leaf entries within bounds */
+static void check_rebuilds( small_tree& tree, bool rows = true, bool overflows = true, std::size_t n = 6000 )
+{
+	data_set data = make_data( n );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, rows, handles );
+
+	CHECK( !tree.rebuilding() );
+	CHECK( ( tree.get_rebuild_stats().overflows > 0 ) == overflows );
+
+	cftree_type::cfentry_vec_type entries;
+	tree.get_entries( entries );
+	check_totals( entries, data );
+	CHECK( entries.size() <= 2 * tree.limit );
+	check_handles( tree, data, handles );
+}
+
+static void test_rebuild()
+{
+	small_tree tree;
+	check_rebuilds( tree, false );
+}
+
+static void test_warm_up()
+{
+	small_tree tree;
+	tree.warm_up( 1000 );
+
+	// the threshold chosen from the buffer leaves room for the rest
+	check_rebuilds( tree, true, false );
+}
+
+/** a buffer short of k_limit still raises the threshold */
+static void test_warm_up_short()
+{
+	small_tree tree;
+	tree.warm_up( tree.limit / 2 );
+	data_set data = make_data( tree.limit / 2 );
+	std::vector<cftree_type::handle_type> handles;
+	build( tree, data, false, handles );
+	CHECK( tree.get_occupancy_stats().leaf_entries < data.size() );
+
+	cftree_type::cfentry_vec_type entries;
+	tree.get_entries( entries );
+	check_totals( entries, data );
+	check_handles( tree, data, handles );
+}
+
+static void test_merge_on_overflow()
+{
+	small_tree tree;
+	tree.merge_on_overflow( 2.0 );
+	check_rebuilds( tree );
+	CHECK( tree.get_rebuild_stats().leaf_merges > 0 );
+}
+
+static void test_background_rebuild()
+{
+	small_tree tree;
+	tree.rebuild_in_background( true );
+	check_rebuilds( tree, false );
+}
+
+static void test_incremental_rebuild()
+{
+	small_tree tree;
+	tree.rebuild_incrementally( 16 );
+	check_rebuilds( tree, false );
+}
+
+/** inserting into an incremental rebuild until part of the previous tree moved, data keeping the data-points inserted */
+static void stop_migrating( small_tree& tree, data_set& data, std::vector<cftree_type::handle_type>& handles )
+{
+	tree.rebuild_incrementally( 16 );
+	tree.track_handles( true );
+
+	data = make_data( 6000 );
+	std::size_t migrating = 0;
+	for( std::size_t r = 0 ; r < data.size() && migrating < 20 ; r++ )
+	{
+		handles.push_back( tree.insert( const_cast<float_type*>( data[r] ) ) );
+		migrating = tree.rebuilding() ? migrating + 1 : 0;
+	}
+	CHECK( migrating == 20 );
+	data.rows.resize( handles.size() * cftree_type::fdim );
+	data.corners.resize( handles.size() );
+}
+
+/** reads while an incremental rebuild is under way see its pending entries, and leave it under way */
+static void test_incremental_reads()
+{
+	small_tree tree;
+	data_set data;
+	std::vector<cftree_type::handle_type> handles;
+	stop_migrating( tree, data, handles );
+
+	cftree_type::cfentry_vec_type entries;
+	tree.get_entries( entries );
+	check_totals( entries, data );
+	CHECK( tree.estimate_closest_dist().mean > 0 );
+
+	check_handles( tree, data, handles );
+	CHECK( tree.leaf_clusters().size() == entries.size() );
+	std::srand( 1 );
+	cftree_type::cfentry_vec_type clusters;
+	tree.cluster( clusters );
+	std::size_t misplaced = 0;
+	for( std::size_t r = 0 ; r < data.size() ; r++ )
+	{
+		int cid = tree.route( data[r], 0.1 );
+		if( cid < 0 || cid >= (int)clusters.size() || cluster_corner( clusters[cid] ) != data.corners[r] )
+			misplaced++;
+	}
+	CHECK( misplaced == 0 );
+	CHECK( tree.rebuilding() );
+}
+
+/** merging a tree amid an incremental rebuild takes its entries not moved yet, amid a background one is refused */
+static void test_merge_rebuilding()
+{
+	small_tree migrating;
+	data_set data;
+	std::vector<cftree_type::handle_type> handles;
+	stop_migrating( migrating, data, handles );
+
+	cftree_type merged( 0.5, 0, 1000 );
+	merged.track_handles( true );
+	merged.merge( migrating );
+	CHECK( migrating.rebuilding() );
+	cftree_type::cfentry_vec_type entries;
+	merged.get_entries( entries );
+	check_totals( entries, data );
+	check_handles( merged, data, handles );
+
+	small_tree background;
+	background.rebuild_in_background( true );
+	data_set more = make_data( 6000 );
+	for( std::size_t r = 0 ; r < more.size() && !background.rebuilding() ; r++ )
+		background.insert( const_cast<float_type*>( more[r] ) );
+	CHECK( background.rebuilding() );
+	bool refused = false;
+	try
+	{
+		merged.merge( background );
+	}
+	catch( const cftree_type::CFTreeRebuilding& )
+	{
+		refused = true;
+	}
+	CHECK( refused );
+	merged.get_entries( entries );
+	check_totals( entries, data );
+}
+
+static void test_bulk_rebuild()
+{
+	small_tree tree;
+	tree.rebuild_in_bulk( true );
+	check_rebuilds( tree );
+}
+
+static void test_partial_rebuild()
+{
+	// subtrees need a level between them and the leaves
+	small_tree tree( 3000 );
+	tree.rebuild_partially( true );
+	check_rebuilds( tree, true, true, 30000 );
+	CHECK( tree.get_rebuild_stats().partial_rebuilds > 0 );
+}
+
+/** a dense subtree rebuilt taller than the one it replaces leaves the rebuild to the whole tree */
+static void test_taller_subtree()
+{
+	// the subtrees bulk-loaded by the first rebuild are full, their entries inserted again need one more level
+	small_tree tree( 3600 );
+	tree.rebuild_target( 0.99f );
+	tree.rebuild_in_bulk( true );
+	tree.track_handles( true );
+	data_set data = make_data( 6000 ), inserted;
+	std::vector<cftree_type::handle_type> handles;
+	std::size_t r = 0;
+	for( ; r < data.size() && tree.get_rebuild_stats().rebuilds == 0 ; r++ )
+	{
+		inserted.rows.insert( inserted.rows.end(), data[r], data[r] + cftree_type::fdim );
+		inserted.corners.push_back( data.corners[r] );
+		handles.push_back( tree.insert( const_cast<float_type*>( data[r] ) ) );
+	}
+
+	// points of one corner split its subtrees alone, the denser ones of the other corners are rebuilt
+	tree.rebuild_in_bulk( false );
+	tree.rebuild_partially( true );
+	const std::size_t rebuilds = tree.get_rebuild_stats().rebuilds;
+	for( ; r < data.size() && tree.get_rebuild_stats().rebuilds == rebuilds ; r++ )
+		if( data.corners[r] == 0 )
+		{
+			inserted.rows.insert( inserted.rows.end(), data[r], data[r] + cftree_type::fdim );
+			inserted.corners.push_back( data.corners[r] );
+			handles.push_back( tree.insert( const_cast<float_type*>( data[r] ) ) );
+		}
+	CHECK( tree.get_rebuild_stats().rebuilds > rebuilds );
+	CHECK( tree.get_rebuild_stats().partial_rebuilds == 0 );
+
+	cftree_type::cfentry_vec_type entries;
+	tree.get_entries( entries );
+	check_totals( entries, inserted );
+	check_handles( tree, inserted, handles );
+}
+
+/** the trees of a forest share the data-points out, and cluster together */
+static void test_forest()
+{
+	data_set data = make_data( 6000 );
+	CFForest<cftree_type::fdim> forest( 4, 0.5, 800, 100 );
+	forest.insert_rows( data.view() );
+	forest.rebuild( false );
+
+	// every data-point is in the tree it is routed to, and in no other
+	std::vector<boost::int32_t> cids( data.size() );
+	forest.tree(0).redist( forest.get_router(), data.view(), &cids[0] );
+	for( std::size_t p = 0 ; p < forest.size() ; p++ )
+	{
+		data_set routed;
+		for( std::size_t r = 0 ; r < data.size() ; r++ )
+			if( cids[r] == (boost::int32_t)p )
+			{
+				routed.rows.insert( routed.rows.end(), data[r], data[r] + cftree_type::fdim );
+				routed.corners.push_back( data.corners[r] );
+			}
+		cftree_type::cfentry_vec_type entries;
+		forest.tree(p).get_entries( entries );
+		if( routed.size() > 0 )
+			check_totals( entries, routed );
+		else
+			CHECK( entries.empty() );
+	}
+
+	cftree_type::cfentry_vec_type entries;
+	forest.get_entries( entries );
+	check_totals( entries, data );
+
+	// every cluster lies at a corner, and the ones of a corner hold its data-points
+	cftree_type::cfentry_vec_type clusters;
+	forest.cluster( clusters );
+	std::vector<std::size_t> counts( n_corners, 0 );
+	for( std::size_t i = 0 ; i < clusters.size() ; i++ )
+	{
+		int c = cluster_corner( clusters[i] );
+		CHECK( c >= 0 );
+		if( c >= 0 )
+			counts[c] += clusters[i].n;
+	}
+	for( int c = 0 ; c < n_corners ; c++ )
+		CHECK( counts[c] == data.size() / n_corners );
+}
+
+struct test_case
+{
+	const char* name;
+	void (*run)();
+};
+
+static const test_case tests[] =
+{
+	{ "insert_rows", test_insert_rows },
+	{ "typed_input", test_typed_input },
+	{ "kmeans", test_kmeans },
+	{ "snapshot", test_snapshot },
+	{ "corrupt_snapshot", test_corrupt_snapshot },
+	{ "recover", test_recover },
+	{ "merging_refinement", test_merging_refinement },
+	{ "merge", test_merge },
+	{ "assign_leaves", test_assign_leaves },
+	{ "rebuild", test_rebuild },
+	{ "warm_up", test_warm_up },
+	{ "warm_up_short", test_warm_up_short },
+	{ "merge_on_overflow", test_merge_on_overflow },
+	{ "background_rebuild", test_background_rebuild },
+	{ "incremental_rebuild", test_incremental_rebuild },
+	{ "incremental_reads", test_incremental_reads },
+	{ "merge_rebuilding", test_merge_rebuilding },
+	{ "bulk_rebuild", test_bulk_rebuild },
+	{ "partial_rebuild", test_partial_rebuild },
+	{ "taller_subtree", test_taller_subtree },
+	{ "forest", test_forest },
+};
+
+int main( int argc, char* argv[] )
+{
+	bool found = false;
+	for( std::size_t i = 0 ; i < ARRAY_COUNT(tests) ; i++ )
+	{
+		if( argc > 1 && std::strcmp( argv[1], tests[i].name ) != 0 )
+			continue;
+		found = true;
+		int before = failures;
+		tests[i].run();
+		std::printf( "%s: %s\n", tests[i].name, failures == before ? "ok" : "FAILED" );
+	}
+
+	if( !found )
+	{
+		std::fprintf( stderr, "unknown test %s\n", argv[1] );
+		return 2;
+	}
+	return failures ? 1 : 0;
+}